@@ -0,0 +1,39 @@
+#pragma once
+
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Where a VM gets its memory from. Embedders can supply their own to use a
+// different malloc, a per-request arena or a pool; every call is passed
+// `userData`, and `reallocate` and `free` are told the size the block was
+// allocated with.
+typedef struct {
+    void* (*allocate)(void* userData, size_t size);
+    void* (*reallocate)(void* userData, void* pointer, size_t oldSize, size_t newSize);
+    void (*free)(void* userData, void* pointer, size_t size);
+    void* userData;
+} Allocator;
+
+// An allocator plus the accounting done on top of it. Each VM has one. During
+// an evaluation, an allocation that fails or would take `bytes` past `limit`
+// (any allocation, if `frozen`) jumps to `recover` so the evaluation can be
+// abandoned cleanly. Outside one
+// the limit is not enforced, and an allocation that fails aborts.
+typedef struct {
+    Allocator allocator;
+    size_t bytes; // currently allocated
+    size_t peak;
+    size_t limit; // 0 for none
+    bool frozen; // every allocation is over the limit
+    jmp_buf* recover; // NULL outside an evaluation: failures abort
+    bool shared; // used from several threads: counters are updated atomically
+} Heap;
+
+// libc malloc, realloc and free.
+extern const Allocator systemAllocator;
+// For scratch space that belongs to no VM, such as the tokenizer's buffers,
+// which worker threads fill. It is shared and has no limit.
+extern Heap systemHeap;
+
+void initHeap(Heap* heap, const Allocator* allocator);
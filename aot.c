@@ -0,0 +1,33 @@
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "aot.h"
+
+InterpretResult aotError(int line, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+
+    fputs("\n", stderr);
+    fprintf(stderr, "[line %d] in script\n", line);
+    return INTERPRET_RUNTIME_ERROR;
+}
+
+int aotMain(AotScript script)
+{
+    VM vm;
+    initVM(&vm);
+    InterpretResult result = script(&vm);
+    flushOutput(&vm.out);
+    freeVM(&vm);
+
+    if (result == INTERPRET_COMPILE_ERROR) {
+        return 65;
+    }
+    if (result == INTERPRET_RUNTIME_ERROR) {
+        return 70;
+    }
+    return 0;
+}
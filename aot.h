@@ -0,0 +1,21 @@
+#pragma once
+
+// The runtime interface of C code generated by `clox --emit-c`. Generated
+// files include only this header and link against the interpreter's objects
+// (`make libclox.a`).
+
+#include <math.h>
+#include <stdint.h>
+
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+
+typedef InterpretResult (*AotScript)(VM* vm);
+
+// Reports a runtime error the way run() does and returns
+// INTERPRET_RUNTIME_ERROR.
+InterpretResult aotError(int line, const char* format, ...);
+// Runs a generated script in a fresh VM and returns the same exit status as
+// `clox script.lox`.
+int aotMain(AotScript script);
@@ -0,0 +1,237 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "cache.h"
+#include "memory.h"
+#include "regchunk.h"
+
+// The source is stored inline so that adding an entry is a single
+// allocation, which either happens or, if the heap is exhausted, leaves the
+// cache untouched.
+struct CachedChunk {
+    uint64_t hash;
+    size_t length;
+    size_t bytes; // footprint charged against the cache capacity
+    Chunk chunk;
+    CachedChunk* chain; // next entry in the same bucket
+    CachedChunk* newer;
+    CachedChunk* older;
+    char source[];
+};
+
+void initChunkCache(ChunkCache* cache, Heap* heap, size_t capacity)
+{
+    *cache = (ChunkCache) {
+        .heap = heap,
+        .capacity = capacity,
+        .bytes = 0,
+        .count = 0,
+        .buckets = NULL,
+        .bucketCount = 0,
+        .newest = NULL,
+        .oldest = NULL,
+        .hits = 0,
+        .misses = 0,
+        .evictions = 0,
+    };
+}
+
+static void freeEntry(ChunkCache* cache, CachedChunk* entry)
+{
+    freeChunk(&entry->chunk);
+    reallocate(cache->heap, entry, sizeof(CachedChunk) + entry->length, 0);
+}
+
+void freeChunkCache(ChunkCache* cache)
+{
+    CachedChunk* entry = cache->newest;
+    while (entry != NULL) {
+        CachedChunk* older = entry->older;
+        freeEntry(cache, entry);
+        entry = older;
+    }
+    FREE_ARRAY(cache->heap, CachedChunk*, cache->buckets, cache->bucketCount);
+    initChunkCache(cache, cache->heap, cache->capacity);
+}
+
+// Reads the source a word at a time; the tail is zero-padded.
+uint64_t hashSource(const char* source, size_t length)
+{
+    uint64_t hash = 0x9e3779b97f4a7c15u ^ length;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, source + i, 8);
+        hash = (hash ^ word) * 0xff51afd7ed558ccdu;
+        hash ^= hash >> 32;
+    }
+    if (i < length) {
+        uint64_t word = 0;
+        memcpy(&word, source + i, length - i);
+        hash = (hash ^ word) * 0xff51afd7ed558ccdu;
+    }
+
+    // The murmur3 finalizer, so the low bits used for buckets are mixed.
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53u;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+static CachedChunk** findBucket(ChunkCache* cache, uint64_t hash)
+{
+    return &cache->buckets[hash & (uint64_t)(cache->bucketCount - 1)];
+}
+
+static void unlinkEntry(ChunkCache* cache, CachedChunk* entry)
+{
+    if (entry->newer != NULL) {
+        entry->newer->older = entry->older;
+    } else {
+        cache->newest = entry->older;
+    }
+    if (entry->older != NULL) {
+        entry->older->newer = entry->newer;
+    } else {
+        cache->oldest = entry->newer;
+    }
+}
+
+static void linkNewest(ChunkCache* cache, CachedChunk* entry)
+{
+    entry->newer = NULL;
+    entry->older = cache->newest;
+    if (cache->newest != NULL) {
+        cache->newest->newer = entry;
+    } else {
+        cache->oldest = entry;
+    }
+    cache->newest = entry;
+}
+
+static void evictOldest(ChunkCache* cache)
+{
+    CachedChunk* entry = cache->oldest;
+    unlinkEntry(cache, entry);
+
+    CachedChunk** link = findBucket(cache, entry->hash);
+    while (*link != entry) {
+        link = &(*link)->chain;
+    }
+    *link = entry->chain;
+
+    cache->bytes -= entry->bytes;
+    cache->count--;
+    cache->evictions++;
+    freeEntry(cache, entry);
+}
+
+void resizeChunkCache(ChunkCache* cache, size_t capacity)
+{
+    cache->capacity = capacity;
+    while (cache->bytes > capacity) {
+        evictOldest(cache);
+    }
+}
+
+Chunk* findCachedChunk(ChunkCache* cache, const char* source, size_t length)
+{
+    if (cache->capacity == 0) {
+        return NULL;
+    }
+
+    if (cache->count > 0) {
+        uint64_t hash = hashSource(source, length);
+        for (CachedChunk* entry = *findBucket(cache, hash); entry != NULL; entry = entry->chain) {
+            if (entry->hash == hash && entry->length == length
+                && memcmp(entry->source, source, length) == 0) {
+                unlinkEntry(cache, entry);
+                linkNewest(cache, entry);
+                cache->hits++;
+                return &entry->chunk;
+            }
+        }
+    }
+    cache->misses++;
+    return NULL;
+}
+
+static void growBuckets(ChunkCache* cache)
+{
+    int oldCount = cache->bucketCount;
+    CachedChunk** old = cache->buckets;
+    int count = GROW_CAPACITY(oldCount);
+    cache->buckets = ALLOCATE(cache->heap, CachedChunk*, count);
+    cache->bucketCount = count;
+    memset(cache->buckets, 0, sizeof(CachedChunk*) * cache->bucketCount);
+
+    for (int i = 0; i < oldCount; i++) {
+        CachedChunk* entry = old[i];
+        while (entry != NULL) {
+            CachedChunk* chain = entry->chain;
+            CachedChunk** bucket = findBucket(cache, entry->hash);
+            entry->chain = *bucket;
+            *bucket = entry;
+            entry = chain;
+        }
+    }
+    FREE_ARRAY(cache->heap, CachedChunk*, old, oldCount);
+}
+
+// Includes the register translation, which the VM attaches to a cached
+// chunk the first time it runs one on the register engine.
+static size_t chunkBytes(Chunk* chunk)
+{
+    size_t bytes = (size_t)chunk->capacity * (sizeof(uint8_t) + sizeof(int))
+        + (size_t)chunk->constants.capacity * sizeof(Value);
+    RegChunk* registers = chunk->registers;
+    if (registers != NULL) {
+        bytes += sizeof(RegChunk) + (size_t)registers->capacity * (sizeof(RegInstruction) + sizeof(int))
+            + (size_t)registers->constants.capacity * sizeof(Value);
+    }
+    return bytes;
+}
+
+Chunk* cacheChunk(ChunkCache* cache, const char* source, size_t length, Chunk* chunk)
+{
+    size_t bytes = sizeof(CachedChunk) + length + chunkBytes(chunk);
+    if (bytes > cache->capacity) {
+        return NULL;
+    }
+    while (cache->bytes + bytes > cache->capacity) {
+        evictOldest(cache);
+    }
+    if (cache->count + 1 > cache->bucketCount * 3 / 4) {
+        growBuckets(cache);
+    }
+
+    CachedChunk* entry = reallocate(cache->heap, NULL, 0, sizeof(CachedChunk) + length);
+    entry->hash = hashSource(source, length);
+    memcpy(entry->source, source, length);
+    entry->length = length;
+    entry->bytes = bytes;
+    entry->chunk = *chunk;
+    initChunk(chunk, chunk->heap);
+
+    CachedChunk** bucket = findBucket(cache, entry->hash);
+    entry->chain = *bucket;
+    *bucket = entry;
+    linkNewest(cache, entry);
+    cache->bytes += bytes;
+    cache->count++;
+    return &entry->chunk;
+}
+
+void recountCachedChunk(ChunkCache* cache, Chunk* chunk)
+{
+    CachedChunk* entry = (CachedChunk*)((char*)chunk - offsetof(CachedChunk, chunk));
+    size_t bytes = sizeof(CachedChunk) + entry->length + chunkBytes(chunk);
+    if (bytes == entry->bytes) {
+        return;
+    }
+    cache->bytes += bytes - entry->bytes;
+    entry->bytes = bytes;
+    while (cache->bytes > cache->capacity) {
+        evictOldest(cache);
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "chunk.h"
+#include "common.h"
+
+#define CHUNK_CACHE_DEFAULT_BYTES (4 << 20)
+
+typedef struct CachedChunk CachedChunk;
+
+// Compiled chunks of recently interpreted sources, keyed by a hash of the
+// source text and evicted least recently used first once their footprint
+// exceeds `capacity` bytes. The constants of a cached chunk may point to
+// objects owned by the VM, so a cache belongs to exactly one VM.
+typedef struct {
+    Heap* heap;
+    size_t capacity; // 0 disables caching
+    size_t bytes;
+    int count;
+    CachedChunk** buckets;
+    int bucketCount; // always a power of two
+    CachedChunk* newest; // head of the LRU list
+    CachedChunk* oldest;
+
+    long hits;
+    long misses;
+    long evictions;
+} ChunkCache;
+
+void initChunkCache(ChunkCache* cache, Heap* heap, size_t capacity);
+void freeChunkCache(ChunkCache* cache);
+// Evicts entries until the cache fits in `capacity` bytes.
+void resizeChunkCache(ChunkCache* cache, size_t capacity);
+uint64_t hashSource(const char* source, size_t length);
+
+// Returns the chunk compiled from exactly this source, or NULL.
+Chunk* findCachedChunk(ChunkCache* cache, const char* source, size_t length);
+// Moves `chunk` into the cache and returns its new home. Returns NULL, and
+// leaves `chunk` alone, if the chunk is larger than the whole cache.
+Chunk* cacheChunk(ChunkCache* cache, const char* source, size_t length, Chunk* chunk);
+// Charges `chunk`, which must be in the cache, for what has been attached to
+// it since it was cached, evicting entries to make room; `chunk` itself goes
+// if it no longer fits at all. Nothing may be running from the cache.
+void recountCachedChunk(ChunkCache* cache, Chunk* chunk);
@@ -2,34 +2,114 @@
 
 #include "chunk.h"
 #include "memory.h"
+#include "regchunk.h"
 #include "value.h"
 
-void initChunk(Chunk* chunk)
+const OpInfo opInfo[OP_COUNT] = {
+    [OP_CONSTANT] = { 1, 0, 1 },
+    [OP_NIL] = { 0, 0, 1 },
+    [OP_TRUE] = { 0, 0, 1 },
+    [OP_FALSE] = { 0, 0, 1 },
+    [OP_EQUAL] = { 0, 2, 1 },
+    [OP_GREATER] = { 0, 2, 1 },
+    [OP_LESS] = { 0, 2, 1 },
+    [OP_ADD] = { 0, 2, 1 },
+    [OP_SUBTRACT] = { 0, 2, 1 },
+    [OP_MULTIPLY] = { 0, 2, 1 },
+    [OP_DIVIDE] = { 0, 2, 1 },
+    [OP_NOT] = { 0, 1, 1 },
+    [OP_NEGATE] = { 0, 1, 1 },
+    [OP_CALL] = { 1, 1, 1 },
+    [OP_RETURN] = { 0, 1, 0 },
+    [OP_POP] = { 0, 1, 0 },
+    [OP_DEFINE_GLOBAL] = { 2, 1, 0 },
+    [OP_GET_GLOBAL] = { 2, 0, 1 },
+    [OP_SET_GLOBAL] = { 2, 1, 1 },
+    [OP_ADD_NUM] = { 0, 2, 1 },
+    [OP_ADD_STR] = { 0, 2, 1 },
+    [OP_SUBTRACT_NUM] = { 0, 2, 1 },
+    [OP_MULTIPLY_NUM] = { 0, 2, 1 },
+    [OP_DIVIDE_NUM] = { 0, 2, 1 },
+    [OP_EQUAL_NUM] = { 0, 2, 1 },
+    [OP_GREATER_NUM] = { 0, 2, 1 },
+    [OP_LESS_NUM] = { 0, 2, 1 },
+    [OP_NEGATE_NUM] = { 0, 1, 1 },
+    [OP_ADD_INT] = { 0, 2, 1 },
+    [OP_SUBTRACT_INT] = { 0, 2, 1 },
+    [OP_MULTIPLY_INT] = { 0, 2, 1 },
+    [OP_EQUAL_INT] = { 0, 2, 1 },
+    [OP_GREATER_INT] = { 0, 2, 1 },
+    [OP_LESS_INT] = { 0, 2, 1 },
+    [OP_NEGATE_INT] = { 0, 1, 1 },
+};
+
+OpCode genericOpcode(OpCode opcode)
+{
+    switch (opcode) {
+    case OP_ADD_NUM:
+    case OP_ADD_STR:
+    case OP_ADD_INT:
+        return OP_ADD;
+    case OP_SUBTRACT_NUM:
+    case OP_SUBTRACT_INT:
+        return OP_SUBTRACT;
+    case OP_MULTIPLY_NUM:
+    case OP_MULTIPLY_INT:
+        return OP_MULTIPLY;
+    case OP_DIVIDE_NUM:
+        return OP_DIVIDE;
+    case OP_EQUAL_NUM:
+    case OP_EQUAL_INT:
+        return OP_EQUAL;
+    case OP_GREATER_NUM:
+    case OP_GREATER_INT:
+        return OP_GREATER;
+    case OP_LESS_NUM:
+    case OP_LESS_INT:
+        return OP_LESS;
+    case OP_NEGATE_NUM:
+    case OP_NEGATE_INT:
+        return OP_NEGATE;
+    default:
+        return opcode;
+    }
+}
+
+void initChunk(Chunk* chunk, Heap* heap)
 {
     *chunk = (Chunk) {
+        .heap = heap,
         .count = 0,
         .capacity = 0,
         .code = NULL,
         .lines = NULL,
+        .maxStack = 0,
+        .registers = NULL,
     };
-    initValueArray(&chunk->constants);
+    initValueArray(&chunk->constants, heap);
 }
 
 void freeChunk(Chunk* chunk)
 {
-    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-    FREE_ARRAY(int, chunk->lines, chunk->capacity);
+    FREE_ARRAY(chunk->heap, uint8_t, chunk->code, chunk->capacity);
+    FREE_ARRAY(chunk->heap, int, chunk->lines, chunk->capacity);
     freeValueArray(&chunk->constants);
-    initChunk(chunk);
+    if (chunk->registers != NULL) {
+        freeRegChunk(chunk->registers);
+        FREE(chunk->heap, struct RegChunk, chunk->registers);
+    }
+    initChunk(chunk, chunk->heap);
 }
 
 void writeChunk(Chunk* chunk, uint8_t byte, int line)
 {
     if (chunk->capacity < chunk->count + 1) {
         int oldCapacity = chunk->capacity;
-        chunk->capacity = GROW_CAPACITY(oldCapacity);
-        chunk->code = GROW_ARRAY(chunk->code, uint8_t, oldCapacity, chunk->capacity);
-        chunk->lines = GROW_ARRAY(chunk->lines, int, oldCapacity, chunk->capacity);
+        int capacity = GROW_CAPACITY(oldCapacity);
+        reserveHeap(chunk->heap, (capacity - oldCapacity) * (sizeof(uint8_t) + sizeof(int)));
+        chunk->code = GROW_ARRAY(chunk->heap, chunk->code, uint8_t, oldCapacity, capacity);
+        chunk->lines = GROW_ARRAY(chunk->heap, chunk->lines, int, oldCapacity, capacity);
+        chunk->capacity = capacity;
     }
     chunk->code[chunk->count] = byte;
     chunk->lines[chunk->count] = line;
@@ -17,19 +17,65 @@ typedef enum {
     OP_DIVIDE,
     OP_NOT,
     OP_NEGATE,
+    OP_CALL,
     OP_RETURN,
+    OP_POP,
+    OP_DEFINE_GLOBAL, // these three take a big-endian two-byte slot of vm->globals
+    OP_GET_GLOBAL,
+    OP_SET_GLOBAL,
+
+    // Quickened variants. The compiler never emits these; run() rewrites a
+    // generic instruction in place once it has seen its operand types, and
+    // rewrites it back when the guard fails.
+    OP_ADD_NUM,
+    OP_ADD_STR,
+    OP_SUBTRACT_NUM,
+    OP_MULTIPLY_NUM,
+    OP_DIVIDE_NUM,
+    OP_EQUAL_NUM,
+    OP_GREATER_NUM,
+    OP_LESS_NUM,
+    OP_NEGATE_NUM,
+    OP_ADD_INT,
+    OP_SUBTRACT_INT,
+    OP_MULTIPLY_INT,
+    OP_EQUAL_INT,
+    OP_GREATER_INT,
+    OP_LESS_INT,
+    OP_NEGATE_INT,
+
+    OP_COUNT
 } OpCode;
 
+// Static shape of an instruction: how many operand bytes follow the opcode
+// and how many stack slots it consumes and produces. OP_CALL also pops as
+// many arguments as its operand says.
+typedef struct {
+    uint8_t operandBytes;
+    uint8_t pops;
+    uint8_t pushes;
+} OpInfo;
+
+extern const OpInfo opInfo[OP_COUNT];
+
+// The instruction a quickened variant was rewritten from.
+OpCode genericOpcode(OpCode opcode);
+
+struct RegChunk;
+
 typedef struct
 {
+    Heap* heap; // of the VM the chunk belongs to
     int count;
     int capacity;
     uint8_t* code;
     int* lines;
+    int maxStack; // deepest the value stack gets while running the chunk
     ValueArray constants;
+    struct RegChunk* registers; // register translation, made on first use
 } Chunk;
 
-void initChunk(Chunk* chunk);
+void initChunk(Chunk* chunk, Heap* heap);
 
 void freeChunk(Chunk* chunk);
 
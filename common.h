@@ -4,5 +4,4 @@
 #include <stddef.h>
 #include <stdint.h>
 
-#define DEBUG_PRINT_CODE
-#define DEBUG_TRACE_EXECUTION
\ No newline at end of file
+#define DEBUG_PRINT_CODE
\ No newline at end of file
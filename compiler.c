@@ -1,11 +1,20 @@
+#define _GNU_SOURCE
+
+#include <setjmp.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "chunk.h"
 #include "common.h"
 #include "compiler.h"
+#include "memory.h"
+#include "number.h"
+#include "object.h"
 #include "scanner.h"
+#include "tokens.h"
 #include "vm.h"
 #ifdef DEBUG_PRINT_CODE
 #include "debug.h"
@@ -17,12 +26,40 @@ typedef struct {
     bool hadError;
     bool panicMode;
     Chunk* currentChunk;
+    int stackDepth;
+    int pendingOperands; // operand bytes still owed by the last opcode
 } Parser;
 
+// What to do once a nested operand has been parsed.
+typedef enum {
+    FRAME_EXPRESSION, // nothing: the outermost parsePrecedence level
+    FRAME_GROUPING, // consume the closing ')'
+    FRAME_UNARY, // emit the prefix operator
+    FRAME_BINARY, // emit the infix operator
+    FRAME_CALL, // parse the next argument or emit the call
+    FRAME_ASSIGN, // store the value in a global
+} FrameKind;
+
+// One level of operator-precedence parsing. The parser keeps these on an
+// explicit stack instead of recursing, so deeply nested input cannot
+// exhaust the native stack.
+typedef struct {
+    FrameKind kind;
+    int precedence; // lowest-precedence infix operator this level accepts
+    TokenType operatorType;
+    int argCount; // FRAME_CALL: arguments before the one being parsed
+    int slot; // FRAME_ASSIGN: the global assigned to
+} ParseFrame;
+
 typedef struct {
     Scanner* scanner;
+    TokenStream* tokens; // tokenized up front, or NULL to scan on demand
+    int nextToken;
     Parser* parser;
     VM* vm;
+    ParseFrame* frames;
+    int frameCount;
+    int frameCapacity;
 } Compiler;
 
 typedef enum {
@@ -88,7 +125,15 @@ static void advance(Compiler* compiler)
 
     parser->previous = parser->current;
     for (;;) {
-        parser->current = scanToken(scanner);
+        if (compiler->tokens != NULL) {
+            // The stream ends with EOF, which keeps being returned.
+            parser->current = tokenAt(compiler->tokens, compiler->nextToken);
+            if (compiler->nextToken < compiler->tokens->count - 1) {
+                compiler->nextToken++;
+            }
+        } else {
+            parser->current = scanToken(scanner);
+        }
         if (parser->current.type != TOKEN_ERROR) {
             break;
         }
@@ -96,6 +141,15 @@ static void advance(Compiler* compiler)
     }
 }
 
+static bool match(Compiler* compiler, TokenType type)
+{
+    if (compiler->parser->current.type != type) {
+        return false;
+    }
+    advance(compiler);
+    return true;
+}
+
 static void consume(Compiler* compiler, TokenType type, const char* message)
 {
     Parser* parser = compiler->parser;
@@ -110,6 +164,20 @@ static void consume(Compiler* compiler, TokenType type, const char* message)
 static void emitByte(Parser* parser, uint8_t byte)
 {
     writeChunk(parser->currentChunk, byte, parser->previous.line);
+
+    if (parser->pendingOperands > 0) {
+        parser->pendingOperands--;
+        return;
+    }
+
+    // An opcode: apply its stack effect so the chunk knows how deep the stack
+    // can get.
+    const OpInfo* info = &opInfo[byte];
+    parser->pendingOperands = info->operandBytes;
+    parser->stackDepth += info->pushes - info->pops;
+    if (parser->stackDepth > parser->currentChunk->maxStack) {
+        parser->currentChunk->maxStack = parser->stackDepth;
+    }
 }
 
 static void emitBytes(Parser* parser, uint8_t byte1, uint8_t byte2)
@@ -149,14 +217,25 @@ static void endCompiler(Compiler* compiler)
 #endif
 }
 
-static void binary(Compiler* compiler)
+static ParseFrame* pushFrame(Compiler* compiler, FrameKind kind, int precedence, TokenType operatorType)
 {
-    Parser* parser = compiler->parser;
-    TokenType operatorType = compiler->parser->previous.type;
-
-    ParseRule* rule = getRule(operatorType);
-    parsePrecedence(rule->precedence + 1, compiler);
+    if (compiler->frameCapacity < compiler->frameCount + 1) {
+        int oldCapacity = compiler->frameCapacity;
+        compiler->frameCapacity = GROW_CAPACITY(oldCapacity);
+        compiler->frames = GROW_ARRAY(&systemHeap, compiler->frames, ParseFrame, oldCapacity, compiler->frameCapacity);
+    }
+    compiler->frames[compiler->frameCount++] = (ParseFrame) {
+        .kind = kind,
+        .precedence = precedence,
+        .operatorType = operatorType,
+        .argCount = 0,
+        .slot = 0,
+    };
+    return &compiler->frames[compiler->frameCount - 1];
+}
 
+static void emitBinary(Parser* parser, TokenType operatorType)
+{
     switch (operatorType) {
     case TOKEN_BANG_EQUAL:
         emitBytes(parser, OP_EQUAL, OP_NOT);
@@ -194,6 +273,29 @@ static void binary(Compiler* compiler)
     }
 }
 
+static void binary(Compiler* compiler)
+{
+    TokenType operatorType = compiler->parser->previous.type;
+    ParseRule* rule = getRule(operatorType);
+    pushFrame(compiler, FRAME_BINARY, rule->precedence + 1, operatorType);
+}
+
+static void emitCall(Parser* parser, int argCount)
+{
+    emitBytes(parser, OP_CALL, argCount);
+    // opInfo only counts the callee; the arguments are popped as well.
+    parser->stackDepth -= argCount;
+}
+
+static void call(Compiler* compiler)
+{
+    if (match(compiler, TOKEN_RIGHT_PAREN)) {
+        emitCall(compiler->parser, 0);
+        return;
+    }
+    pushFrame(compiler, FRAME_CALL, PREC_ASSIGNMENT, TOKEN_LEFT_PAREN);
+}
+
 static void literal(Compiler* compiler)
 {
     Parser* parser = compiler->parser;
@@ -214,31 +316,77 @@ static void literal(Compiler* compiler)
 
 static void grouping(Compiler* compiler)
 {
-    expression(compiler);
-    consume(compiler, TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
+    pushFrame(compiler, FRAME_GROUPING, PREC_ASSIGNMENT, TOKEN_LEFT_PAREN);
 }
 
 static void number(Compiler* compiler)
 {
     Parser* parser = compiler->parser;
-    double value = strtod(parser->previous.start, NULL);
-    emitConstant(parser, NUMBER_VAL(value));
+    const char* start = parser->previous.start;
+    int length = parser->previous.length;
+
+    // Literals without a fraction are integers unless they overflow int64_t.
+    int64_t integer;
+    if (memchr(start, '.', length) == NULL && parseInteger(start, length, &integer)) {
+        emitConstant(parser, INT_VAL(integer));
+        return;
+    }
+    emitConstant(parser, NUMBER_VAL(parseNumber(start, length)));
 }
 
 static void string(Compiler* compiler)
 {
     VM* vm = compiler->vm;
     Parser* parser = compiler->parser;
-    emitConstant(parser, OBJ_VAL(copyString(vm, parser->previous.start + 1, parser->previous.length - 2)));
+    emitConstant(parser, stringValue(vm, parser->previous.start + 1, parser->previous.length - 2));
 }
 
-static void unary(Compiler* compiler)
+static void emitGlobal(Parser* parser, OpCode opcode, int slot)
+{
+    emitByte(parser, opcode);
+    emitBytes(parser, (uint8_t)(slot >> 8), (uint8_t)slot);
+}
+
+// Resolves a name to its slot in vm->globals, adding the slot the first time
+// the name is seen, so the instructions never look names up.
+static int globalSlot(Compiler* compiler, Token* name)
+{
+    int slot = declareGlobal(&compiler->vm->globals, name->start, name->length);
+    if (slot < 0) {
+        errorAt(compiler->parser, name, "Too many global variables.");
+        return 0;
+    }
+    return slot;
+}
+
+// Builtins are resolved while compiling and the native object itself becomes
+// a constant. Any other name is a global.
+static void variable(Compiler* compiler)
 {
     Parser* parser = compiler->parser;
-    TokenType operatorType = parser->previous.type;
+    Token name = parser->previous;
+    ObjNative* native = findNative(compiler->vm, name.start, name.length);
+
+    // Only a frame that would accept an assignment operator can contain one.
+    bool canAssign = compiler->frames[compiler->frameCount - 1].precedence <= PREC_ASSIGNMENT;
+    if (canAssign && match(compiler, TOKEN_EQUAL)) {
+        if (native != NULL) {
+            errorAt(parser, &name, "Can't assign to builtin.");
+        }
+        int slot = native != NULL ? 0 : globalSlot(compiler, &name);
+        pushFrame(compiler, FRAME_ASSIGN, PREC_ASSIGNMENT, TOKEN_EQUAL)->slot = slot;
+        return;
+    }
 
-    parsePrecedence(PREC_UNARY, compiler);
+    if (native != NULL) {
+        emitConstant(parser, OBJ_VAL((Obj*)native));
+        return;
+    }
+    emitGlobal(parser, OP_GET_GLOBAL, globalSlot(compiler, &name));
+}
 
+static void emitUnary(Parser* parser, TokenType operatorType)
+{
     switch (operatorType) {
     case TOKEN_BANG:
         emitByte(parser, OP_NOT);
@@ -251,8 +399,13 @@ static void unary(Compiler* compiler)
     }
 }
 
+static void unary(Compiler* compiler)
+{
+    pushFrame(compiler, FRAME_UNARY, PREC_UNARY, compiler->parser->previous.type);
+}
+
 ParseRule rules[] = {
-    [TOKEN_LEFT_PAREN] = { grouping, NULL, PREC_NONE },
+    [TOKEN_LEFT_PAREN] = { grouping, call, PREC_CALL },
     [TOKEN_RIGHT_PAREN] = { NULL, NULL, PREC_NONE },
     [TOKEN_LEFT_BRACE] = { NULL, NULL, PREC_NONE },
     [TOKEN_RIGHT_BRACE] = { NULL, NULL, PREC_NONE },
@@ -271,7 +424,7 @@ ParseRule rules[] = {
     [TOKEN_GREATER_EQUAL] = { NULL, binary, PREC_COMPARISON },
     [TOKEN_LESS] = { NULL, binary, PREC_COMPARISON },
     [TOKEN_LESS_EQUAL] = { NULL, binary, PREC_COMPARISON },
-    [TOKEN_IDENTIFIER] = { NULL, NULL, PREC_NONE },
+    [TOKEN_IDENTIFIER] = { variable, NULL, PREC_NONE },
     [TOKEN_STRING] = { string, NULL, PREC_NONE },
     [TOKEN_NUMBER] = { number, NULL, PREC_NONE },
     [TOKEN_AND] = { NULL, NULL, PREC_NONE },
@@ -294,23 +447,94 @@ ParseRule rules[] = {
     [TOKEN_EOF] = { NULL, NULL, PREC_NONE },
 };
 
-static void parsePrecedence(Precedence precedence, Compiler* compiler)
+// Returns true if finishing the frame pushed a new one, whose operand has to
+// be parsed next.
+static bool finishFrame(Compiler* compiler, ParseFrame* frame)
 {
-    advance(compiler);
-
-    Parser* parser = compiler->parser;
+    // variable() takes the '=' of a valid assignment, so one that is still
+    // here follows something else.
+    if (frame->precedence <= PREC_ASSIGNMENT && match(compiler, TOKEN_EQUAL)) {
+        error(compiler->parser, "Invalid assignment target.");
+    }
 
-    ParseFn prefixRule = getRule(parser->previous.type)->prefix;
-    if (prefixRule == NULL) {
-        error(parser, "Expect expression.");
-        return;
+    switch (frame->kind) {
+    case FRAME_EXPRESSION:
+        break;
+    case FRAME_GROUPING:
+        consume(compiler, TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
+        break;
+    case FRAME_UNARY:
+        emitUnary(compiler->parser, frame->operatorType);
+        break;
+    case FRAME_BINARY:
+        emitBinary(compiler->parser, frame->operatorType);
+        break;
+    case FRAME_CALL: {
+        int argCount = frame->argCount + 1;
+        if (match(compiler, TOKEN_COMMA)) {
+            if (argCount == UINT8_MAX) {
+                error(compiler->parser, "Can't have more than 255 arguments.");
+            }
+            pushFrame(compiler, FRAME_CALL, PREC_ASSIGNMENT, TOKEN_LEFT_PAREN)->argCount = argCount;
+            return true;
+        }
+        consume(compiler, TOKEN_RIGHT_PAREN, "Expect ')' after arguments.");
+        emitCall(compiler->parser, argCount);
+        break;
     }
+    case FRAME_ASSIGN:
+        emitGlobal(compiler->parser, OP_SET_GLOBAL, frame->slot);
+        break;
+    }
+    return false;
+}
 
-    prefixRule(compiler);
-    while (precedence <= getRule(parser->current.type)->precedence) {
+// Pratt parsing without recursion. Prefix and infix rules that would recurse
+// (grouping, unary, binary) push a frame instead; the loop then parses the
+// nested operand and finishes the frame once no infix operator binds
+// tighter, exactly where the recursive call would have returned.
+static void parsePrecedence(Precedence precedence, Compiler* compiler)
+{
+    Parser* parser = compiler->parser;
+    int base = compiler->frameCount;
+    pushFrame(compiler, FRAME_EXPRESSION, precedence, TOKEN_EOF);
+
+    for (;;) {
         advance(compiler);
-        ParseFn infixRule = getRule(parser->previous.type)->infix;
-        infixRule(compiler);
+        ParseFn prefixRule = getRule(parser->previous.type)->prefix;
+        if (prefixRule == NULL) {
+            error(parser, "Expect expression.");
+            compiler->frameCount = base;
+            return;
+        }
+
+        int frameCount = compiler->frameCount;
+        prefixRule(compiler);
+        if (compiler->frameCount > frameCount) {
+            continue;
+        }
+
+        for (;;) {
+            ParseFrame frame = compiler->frames[compiler->frameCount - 1];
+            if (frame.precedence <= (int)getRule(parser->current.type)->precedence) {
+                advance(compiler);
+                ParseFn infixRule = getRule(parser->previous.type)->infix;
+                frameCount = compiler->frameCount;
+                infixRule(compiler);
+                if (compiler->frameCount > frameCount) {
+                    break;
+                }
+                continue;
+            }
+
+            compiler->frameCount--;
+            if (finishFrame(compiler, &frame)) {
+                break;
+            }
+            if (compiler->frameCount == base) {
+                return;
+            }
+        }
     }
 }
 
@@ -324,27 +548,126 @@ static void expression(Compiler* compiler)
     parsePrecedence(PREC_ASSIGNMENT, compiler);
 }
 
+static void varDeclaration(Compiler* compiler)
+{
+    Parser* parser = compiler->parser;
+    consume(compiler, TOKEN_IDENTIFIER, "Expect variable name.");
+    Token name = parser->previous;
+    if (findNative(compiler->vm, name.start, name.length) != NULL) {
+        error(parser, "Can't redefine builtin.");
+    }
+
+    if (match(compiler, TOKEN_EQUAL)) {
+        expression(compiler);
+    } else {
+        emitByte(parser, OP_NIL);
+    }
+    consume(compiler, TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
+    if (!parser->hadError) {
+        emitGlobal(parser, OP_DEFINE_GLOBAL, globalSlot(compiler, &name));
+    }
+}
+
+// A script is a run of declarations and expression statements, optionally
+// followed by one expression without a ';'. That expression is the result;
+// a script without one evaluates to nil.
+static void program(Compiler* compiler)
+{
+    Parser* parser = compiler->parser;
+    while (!parser->hadError) {
+        if (match(compiler, TOKEN_VAR)) {
+            varDeclaration(compiler);
+            continue;
+        }
+        if (parser->current.type == TOKEN_EOF) {
+            emitByte(parser, OP_NIL);
+            return;
+        }
+
+        expression(compiler);
+        if (!match(compiler, TOKEN_SEMICOLON)) {
+            consume(compiler, TOKEN_EOF, "Expect end of expression.");
+            return;
+        }
+        emitByte(parser, OP_POP);
+    }
+}
+
+static void freeScratch(Compiler* compiler)
+{
+    FREE_ARRAY(&systemHeap, ParseFrame, compiler->frames, compiler->frameCapacity);
+    if (compiler->tokens != NULL) {
+        freeTokenStream(compiler->tokens);
+    }
+}
+
+// The frames and tokens are scratch on systemHeap, but the chunk and its
+// constants come from the VM's heap. If one of those allocations fails,
+// free the scratch here before the failure carries on to interpret(). The
+// compiler is reached through a pointer, so none of this function's locals
+// change between setjmp() and longjmp().
+static void parseRecovering(Compiler* compiler, int globalCount)
+{
+    VM* vm = compiler->vm;
+    jmp_buf* outer = vm->heap.recover;
+    jmp_buf recover;
+    if (outer != NULL) {
+        if (setjmp(recover)) {
+            freeScratch(compiler);
+            forgetGlobals(&vm->globals, globalCount);
+            vm->heap.recover = outer;
+            longjmp(*outer, 1);
+        }
+        vm->heap.recover = &recover;
+    }
+
+    advance(compiler);
+    program(compiler);
+    endCompiler(compiler);
+    vm->heap.recover = outer;
+}
+
 bool compile(VM* vm, const char* source, Chunk* chunk)
 {
     Scanner scanner;
     initScanner(&scanner, source);
 
+    // Large sources are tokenized up front when there are cores to spread
+    // the work over; with one core scanning on demand is cheaper.
+    size_t length = strlen(source);
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    TokenStream tokens;
+    bool pretokenized = threads > 1 && length >= 2 * TOKENIZE_PARALLEL_MIN
+        && tokenize(&tokens, source, length, threads);
+
     Parser parser = (Parser) {
         .hadError = false,
         .panicMode = false,
         .currentChunk = chunk,
+        .stackDepth = 0,
+        .pendingOperands = 0,
     };
 
     Compiler compiler = (Compiler) {
         .parser = &parser,
         .scanner = &scanner,
-        .vm = vm
+        .tokens = pretokenized ? &tokens : NULL,
+        .nextToken = 0,
+        .vm = vm,
+        .frames = NULL,
+        .frameCount = 0,
+        .frameCapacity = 0,
     };
 
-    advance(&compiler);
-    expression(&compiler);
-    consume(&compiler, TOKEN_EOF, "Expect end of expression.");
-    endCompiler(&compiler);
+    // Globals the source declares are forgotten again if it fails to
+    // compile, so that rejected sources cannot use up the slots.
+    int globalCount = vm->globals.count;
+
+    parseRecovering(&compiler, globalCount);
+    freeScratch(&compiler);
+    if (parser.hadError) {
+        forgetGlobals(&vm->globals, globalCount);
+    }
 
     return !parser.hadError;
 }
@@ -19,6 +19,13 @@ static int simpleInstruction(const char* name, int offset)
     return offset + 1;
 }
 
+static int byteInstruction(const char* name, Chunk* chunk, int offset)
+{
+    uint8_t operand = chunk->code[offset + 1];
+    printf("%-16s %4d\n", name, operand);
+    return offset + 2;
+}
+
 static int constantInstruction(const char* name, Chunk* chunk, int offset)
 {
     // constant index because that one is pushed one further than the instruction
@@ -29,6 +36,56 @@ static int constantInstruction(const char* name, Chunk* chunk, int offset)
     return offset + 2;
 }
 
+static int globalInstruction(const char* name, Chunk* chunk, int offset)
+{
+    uint16_t slot = (uint16_t)(chunk->code[offset + 1] << 8 | chunk->code[offset + 2]);
+    printf("%-16s %4d\n", name, slot);
+    return offset + 3;
+}
+
+static const char* opNames[OP_COUNT] = {
+    [OP_CONSTANT] = "OP_CONSTANT",
+    [OP_NIL] = "OP_NIL",
+    [OP_TRUE] = "OP_TRUE",
+    [OP_FALSE] = "OP_FALSE",
+    [OP_EQUAL] = "OP_EQUAL",
+    [OP_GREATER] = "OP_GREATER",
+    [OP_LESS] = "OP_LESS",
+    [OP_ADD] = "OP_ADD",
+    [OP_SUBTRACT] = "OP_SUBTRACT",
+    [OP_MULTIPLY] = "OP_MULTIPLY",
+    [OP_DIVIDE] = "OP_DIVIDE",
+    [OP_NOT] = "OP_NOT",
+    [OP_NEGATE] = "OP_NEGATE",
+    [OP_CALL] = "OP_CALL",
+    [OP_RETURN] = "OP_RETURN",
+    [OP_POP] = "OP_POP",
+    [OP_DEFINE_GLOBAL] = "OP_DEFINE_GLOBAL",
+    [OP_GET_GLOBAL] = "OP_GET_GLOBAL",
+    [OP_SET_GLOBAL] = "OP_SET_GLOBAL",
+    [OP_ADD_NUM] = "OP_ADD_NUM",
+    [OP_ADD_STR] = "OP_ADD_STR",
+    [OP_SUBTRACT_NUM] = "OP_SUBTRACT_NUM",
+    [OP_MULTIPLY_NUM] = "OP_MULTIPLY_NUM",
+    [OP_DIVIDE_NUM] = "OP_DIVIDE_NUM",
+    [OP_EQUAL_NUM] = "OP_EQUAL_NUM",
+    [OP_GREATER_NUM] = "OP_GREATER_NUM",
+    [OP_LESS_NUM] = "OP_LESS_NUM",
+    [OP_NEGATE_NUM] = "OP_NEGATE_NUM",
+    [OP_ADD_INT] = "OP_ADD_INT",
+    [OP_SUBTRACT_INT] = "OP_SUBTRACT_INT",
+    [OP_MULTIPLY_INT] = "OP_MULTIPLY_INT",
+    [OP_EQUAL_INT] = "OP_EQUAL_INT",
+    [OP_GREATER_INT] = "OP_GREATER_INT",
+    [OP_LESS_INT] = "OP_LESS_INT",
+    [OP_NEGATE_INT] = "OP_NEGATE_INT",
+};
+
+const char* opcodeName(uint8_t opcode)
+{
+    return opcode < OP_COUNT ? opNames[opcode] : NULL;
+}
+
 int disassembleInstruction(Chunk* chunk, int offset)
 {
     printf("%04d ", offset);
@@ -40,38 +97,110 @@ int disassembleInstruction(Chunk* chunk, int offset)
 
     // get current instruction
     uint8_t instruction = chunk->code[offset];
+    const char* name = opcodeName(instruction);
 
     switch (instruction) {
-    case OP_RETURN:
-        return simpleInstruction("OP_RETURN", offset);
+    case OP_CALL:
+        return byteInstruction(name, chunk, offset);
+    case OP_DEFINE_GLOBAL:
+    case OP_GET_GLOBAL:
+    case OP_SET_GLOBAL:
+        return globalInstruction(name, chunk, offset);
     case OP_CONSTANT:
-        return constantInstruction("OP_CONSTANT", chunk, offset);
-    case OP_NEGATE:
-        return simpleInstruction("OP_NEGATE", offset);
-    case OP_ADD:
-        return simpleInstruction("OP_ADD", offset);
-    case OP_SUBTRACT:
-        return simpleInstruction("OP_SUBTRACT", offset);
-    case OP_MULTIPLY:
-        return simpleInstruction("OP_MULTIPLY", offset);
-    case OP_DIVIDE:
-        return simpleInstruction("OP_DIVIDE", offset);
-    case OP_NIL:
-        return simpleInstruction("OP_NIL", offset);
-    case OP_TRUE:
-        return simpleInstruction("OP_TRUE", offset);
-    case OP_FALSE:
-        return simpleInstruction("OP_FALSE", offset);
-    case OP_NOT:
-        return simpleInstruction("OP_NOT", offset);
-    case OP_EQUAL:
-        return simpleInstruction("OP_EQUAL", offset);
-    case OP_GREATER:
-        return simpleInstruction("OP_GREATER", offset);
-    case OP_LESS:
-        return simpleInstruction("OP_LESS", offset);
+        return constantInstruction(name, chunk, offset);
     default:
-        printf("Unknown opcode %d\n", instruction);
-        return offset + 1;
+        if (name == NULL) {
+            printf("Unknown opcode %d\n", instruction);
+            return offset + 1;
+        }
+        return simpleInstruction(name, offset);
     }
 }
+
+static const char* regOpNames[REG_OP_COUNT] = {
+    [REG_LOAD_CONSTANT] = "LOADK",
+    [REG_ADD] = "ADD",
+    [REG_SUBTRACT] = "SUB",
+    [REG_MULTIPLY] = "MUL",
+    [REG_DIVIDE] = "DIV",
+    [REG_EQUAL] = "EQ",
+    [REG_GREATER] = "GT",
+    [REG_LESS] = "LT",
+    [REG_NOT] = "NOT",
+    [REG_NEGATE] = "NEG",
+    [REG_CALL] = "CALL",
+    [REG_GET_GLOBAL] = "GETG",
+    [REG_SET_GLOBAL] = "SETG",
+    [REG_DEFINE_GLOBAL] = "DEFG",
+    [REG_RETURN] = "RETURN",
+};
+
+const char* regOpcodeName(uint8_t opcode)
+{
+    return opcode < REG_OP_COUNT ? regOpNames[opcode] : NULL;
+}
+
+// Prints a register operand as rN, or a constant as its value.
+static void registerOperand(RegChunk* chunk, uint16_t operand, bool constant)
+{
+    if (constant) {
+        printf("k%d '", operand);
+        printValue(chunk->constants.values[operand]);
+        printf("'");
+    } else {
+        printf("r%d", operand);
+    }
+}
+
+void disassembleRegChunk(RegChunk* chunk, const char* name)
+{
+    printf("== %s == \n", name);
+
+    for (int index = 0; index < chunk->count; index++) {
+        RegInstruction* instruction = &chunk->code[index];
+        printf("%04d ", index);
+        if (index > 0 && chunk->lines[index] == chunk->lines[index - 1]) {
+            printf("   | ");
+        } else {
+            printf("%4d ", chunk->lines[index]);
+        }
+        printf("%-7s ", regOpNames[instruction->op]);
+
+        bool b = instruction->flags & REG_B_CONSTANT;
+        bool c = instruction->flags & REG_C_CONSTANT;
+        switch (instruction->op) {
+        case REG_LOAD_CONSTANT:
+            printf("r%d, ", instruction->a);
+            registerOperand(chunk, instruction->b, true);
+            break;
+        case REG_NOT:
+        case REG_NEGATE:
+            printf("r%d, ", instruction->a);
+            registerOperand(chunk, instruction->b, b);
+            break;
+        case REG_CALL:
+            printf("r%d, %d", instruction->a, instruction->b);
+            break;
+        case REG_GET_GLOBAL:
+            printf("r%d, g%d", instruction->a, instruction->b);
+            break;
+        case REG_SET_GLOBAL:
+        case REG_DEFINE_GLOBAL:
+            printf("g%d, ", instruction->a);
+            registerOperand(chunk, instruction->b, b);
+            break;
+        case REG_RETURN:
+            registerOperand(chunk, instruction->b, b);
+            break;
+        default:
+            printf("r%d, ", instruction->a);
+            registerOperand(chunk, instruction->b, b);
+            printf(", ");
+            registerOperand(chunk, instruction->c, c);
+            break;
+        }
+        printf("\n");
+    }
+
+    printf("== %s == \n", "end");
+}
@@ -1,6 +1,11 @@
 #pragma once
 
 #include "chunk.h"
+#include "regchunk.h"
 
 void disassembleChunk(Chunk* chunk, const char* name);
-int disassembleInstruction(Chunk* chunk, int offset);
\ No newline at end of file
+int disassembleInstruction(Chunk* chunk, int offset);
+void disassembleRegChunk(RegChunk* chunk, const char* name);
+// The names the disassemblers print, or NULL for an unknown opcode.
+const char* opcodeName(uint8_t opcode);
+const char* regOpcodeName(uint8_t opcode);
\ No newline at end of file
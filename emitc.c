@@ -0,0 +1,365 @@
+#include <inttypes.h>
+#include <math.h>
+#include <string.h>
+
+#include "emitc.h"
+#include "memory.h"
+#include "object.h"
+
+// Bytecode has no jumps, so the stack depth before every instruction is
+// known statically and each stack slot becomes a local, s0 to sN. Globals
+// become locals too, g0 to gN by slot, and whether one is defined at a given
+// instruction is known statically. So is whether a slot holds a native:
+// natives only enter the stack as constants, possibly by way of a global.
+
+static void emitString(FILE* out, const char* chars, int length)
+{
+    fputc('"', out);
+    for (int i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)chars[i];
+        if (c == '"' || c == '\\' || c == '?') {
+            fprintf(out, "\\%c", c);
+        } else if (c < ' ' || c >= 0x7f) {
+            fprintf(out, "\\%03o", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static void emitDouble(FILE* out, double number)
+{
+    if (isnan(number)) {
+        fprintf(out, "NAN");
+    } else if (isinf(number)) {
+        fprintf(out, number < 0 ? "-INFINITY" : "INFINITY");
+    } else {
+        // Hexadecimal floating point is exact.
+        fprintf(out, "%a", number);
+    }
+}
+
+static void emitValue(FILE* out, Value value, int constant)
+{
+    if (IS_ANY_STRING(value)) {
+        int length;
+        const char* chars = stringChars(&value, &length);
+        fprintf(out, "stringValue(vm, ");
+        emitString(out, chars, length);
+        fprintf(out, ", %d)", length);
+        return;
+    }
+
+    switch (value.type) {
+    case VAL_NIL:
+        fprintf(out, "NIL_VAL");
+        break;
+    case VAL_BOOL:
+        fprintf(out, "BOOL_VAL(%s)", AS_BOOL(value) ? "true" : "false");
+        break;
+    case VAL_NUMBER:
+        fprintf(out, "NUMBER_VAL(");
+        emitDouble(out, AS_NUMBER(value));
+        fprintf(out, ")");
+        break;
+    case VAL_INT:
+        if (AS_INT(value) == INT64_MIN) {
+            fprintf(out, "INT_VAL(INT64_MIN)");
+        } else {
+            fprintf(out, "INT_VAL(INT64_C(%" PRId64 "))", AS_INT(value));
+        }
+        break;
+    default:
+        fprintf(out, "OBJ_VAL(native%d)", constant);
+        break;
+    }
+}
+
+// Same checks and messages as the matching cases of run(). `chained`
+// continues an if statement the caller has opened.
+static void emitArithmetic(FILE* out, int a, int b, int line, const char* intFunction, char op,
+    const char* message, bool chained)
+{
+    fprintf(out, "    %sif (IS_INT(s%d) && IS_INT(s%d)) {\n", chained ? "} else " : "", a, b);
+    fprintf(out, "        s%d = %s(AS_INT(s%d), AS_INT(s%d));\n", a, intFunction, a, b);
+    fprintf(out, "    } else if (IS_NUMERIC(s%d) && IS_NUMERIC(s%d)) {\n", a, b);
+    fprintf(out, "        s%d = NUMBER_VAL(AS_DOUBLE(s%d) %c AS_DOUBLE(s%d));\n", a, a, op, b);
+    fprintf(out, "    } else {\n");
+    fprintf(out, "        return aotError(%d, \"%s\");\n", line, message);
+    fprintf(out, "    }\n");
+}
+
+// `mixed` names the exact comparison for one int and one double.
+static void emitComparison(FILE* out, int a, int b, int line, char op, const char* mixed)
+{
+    fprintf(out, "    if (IS_INT(s%d) && IS_INT(s%d)) {\n", a, b);
+    fprintf(out, "        s%d = BOOL_VAL(AS_INT(s%d) %c AS_INT(s%d));\n", a, a, op, b);
+    fprintf(out, "    } else if (IS_NUMBER(s%d) && IS_NUMBER(s%d)) {\n", a, b);
+    fprintf(out, "        s%d = BOOL_VAL(AS_NUMBER(s%d) %c AS_NUMBER(s%d));\n", a, a, op, b);
+    fprintf(out, "    } else if (IS_NUMERIC(s%d) && IS_NUMERIC(s%d)) {\n", a, b);
+    fprintf(out, "        s%d = BOOL_VAL(%s(s%d, s%d));\n", a, mixed, a, b);
+    fprintf(out, "    } else {\n");
+    fprintf(out, "        return aotError(%d, \"Operands must be numbers.\");\n", line);
+    fprintf(out, "    }\n");
+}
+
+// Returns false if the call always fails, in which case the emitted code
+// returns unconditionally.
+static bool emitCall(FILE* out, Chunk* chunk, int* constantOf, int callee, int argCount, int line)
+{
+    int constant = constantOf[callee];
+    Value value = constant < 0 ? NIL_VAL : chunk->constants.values[constant];
+    if (!IS_NATIVE(value)) {
+        fprintf(out, "    return aotError(%d, \"Can only call functions.\");\n", line);
+        return false;
+    }
+    ObjNative* native = AS_NATIVE(value);
+    if (argCount != native->arity) {
+        fprintf(out, "    return aotError(%d, \"Expected %%d arguments but got %%d.\", %d, %d);\n",
+            line, native->arity, argCount);
+        return false;
+    }
+
+    if (native->function != NULL) {
+        fprintf(out, "    {\n        Value args[] = { ");
+        for (int i = 1; i <= argCount; i++) {
+            fprintf(out, "s%d%s", callee + i, i < argCount ? ", " : "");
+        }
+        if (argCount == 0) {
+            fprintf(out, "NIL_VAL");
+        }
+        fprintf(out, " };\n        s%d = native%d->function(%d, args);\n    }\n", callee, constant, argCount);
+        return true;
+    }
+
+    for (int i = 1; i <= argCount; i++) {
+        fprintf(out, "    if (!IS_NUMERIC(s%d)) {\n", callee + i);
+        fprintf(out, "        return aotError(%d, \"Arguments to '%%s' must be numbers.\", native%d->name);\n",
+            line, constant);
+        fprintf(out, "    }\n");
+    }
+    if (argCount == 1) {
+        fprintf(out, "    s%d = NUMBER_VAL(native%d->number1(AS_DOUBLE(s%d)));\n",
+            callee, constant, callee + 1);
+    } else {
+        fprintf(out, "    s%d = NUMBER_VAL(native%d->number2(AS_DOUBLE(s%d), AS_DOUBLE(s%d)));\n",
+            callee, constant, callee + 1, callee + 2);
+    }
+    return true;
+}
+
+static int globalOperand(Chunk* chunk, int offset)
+{
+    return chunk->code[offset + 1] << 8 | chunk->code[offset + 2];
+}
+
+static void emitUndefined(FILE* out, VM* vm, int slot, int line)
+{
+    GlobalName* name = &vm->globals.names[slot];
+    fprintf(out, "    return aotError(%d, \"Undefined variable '%%s'.\", ", line);
+    emitString(out, name->chars, name->length);
+    fprintf(out, ");\n");
+}
+
+// What the translator knows about each global: whether it is defined yet,
+// and the constant it holds, if any.
+typedef struct {
+    bool defined;
+    int constant;
+} GlobalState;
+
+bool emitC(VM* vm, Chunk* chunk, const char* scriptName, FILE* out)
+{
+    fprintf(out, "// Generated by clox --emit-c from %s.\n\n", scriptName);
+    fprintf(out, "#include \"aot.h\"\n\n");
+    fprintf(out, "static InterpretResult script(VM* vm)\n{\n");
+
+    for (int i = 0; i < chunk->constants.count; i++) {
+        Value value = chunk->constants.values[i];
+        if (IS_NATIVE(value)) {
+            const char* name = AS_NATIVE(value)->name;
+            fprintf(out, "    ObjNative* native%d = findNative(vm, ", i);
+            emitString(out, name, (int)strlen(name));
+            fprintf(out, ", %d);\n", (int)strlen(name));
+        }
+    }
+    if (chunk->maxStack > 0) {
+        fprintf(out, "    Value s0");
+        for (int i = 1; i < chunk->maxStack; i++) {
+            fprintf(out, ", s%d", i);
+        }
+        fprintf(out, ";\n");
+    }
+
+    // Declare a local for every global the chunk mentions.
+    GlobalState* globals = ALLOCATE(&systemHeap, GlobalState, vm->globals.count + 1);
+    for (int i = 0; i < vm->globals.count; i++) {
+        globals[i] = (GlobalState) { .defined = false, .constant = -1 };
+    }
+    for (int offset = 0; offset < chunk->count; offset += 1 + opInfo[chunk->code[offset]].operandBytes) {
+        OpCode opcode = genericOpcode(chunk->code[offset]);
+        if (opcode == OP_DEFINE_GLOBAL || opcode == OP_GET_GLOBAL || opcode == OP_SET_GLOBAL) {
+            int slot = globalOperand(chunk, offset);
+            if (!globals[slot].defined) {
+                fprintf(out, "    Value g%d;\n", slot);
+                globals[slot].defined = true;
+            }
+        }
+    }
+
+    // A local may never be read: a global only ever assigned, a value popped
+    // as soon as it is pushed, a native the code returns before calling.
+    // The casts keep -Wall quiet about those.
+    fprintf(out, "    (void)vm;\n");
+    for (int i = 0; i < chunk->constants.count; i++) {
+        if (IS_NATIVE(chunk->constants.values[i])) {
+            fprintf(out, "    (void)native%d;\n", i);
+        }
+    }
+    for (int i = 0; i < chunk->maxStack; i++) {
+        fprintf(out, "    (void)s%d;\n", i);
+    }
+    for (int i = 0; i < vm->globals.count; i++) {
+        if (globals[i].defined) {
+            fprintf(out, "    (void)g%d;\n", i);
+        }
+        globals[i].defined = false;
+    }
+    fprintf(out, "\n");
+
+    int* constantOf = ALLOCATE(&systemHeap, int, chunk->maxStack + 1);
+    int depth = 0;
+    int offset = 0;
+    bool reachable = true;
+    while (offset < chunk->count && reachable) {
+        OpCode opcode = genericOpcode(chunk->code[offset]);
+        int line = chunk->lines[offset];
+        int top = depth - 1;
+        fprintf(out, "    // %04d line %d\n", offset, line);
+
+        switch (opcode) {
+        case OP_CONSTANT: {
+            int constant = chunk->code[offset + 1];
+            fprintf(out, "    s%d = ", depth);
+            emitValue(out, chunk->constants.values[constant], constant);
+            fprintf(out, ";\n");
+            constantOf[depth] = constant;
+            break;
+        }
+        case OP_NIL:
+            fprintf(out, "    s%d = NIL_VAL;\n", depth);
+            break;
+        case OP_TRUE:
+            fprintf(out, "    s%d = BOOL_VAL(true);\n", depth);
+            break;
+        case OP_FALSE:
+            fprintf(out, "    s%d = BOOL_VAL(false);\n", depth);
+            break;
+        case OP_EQUAL:
+            fprintf(out, "    s%d = BOOL_VAL(valuesEqual(s%d, s%d));\n", top - 1, top - 1, top);
+            break;
+        case OP_GREATER:
+            emitComparison(out, top - 1, top, line, '>', "mixedGreater");
+            break;
+        case OP_LESS:
+            emitComparison(out, top - 1, top, line, '<', "mixedLess");
+            break;
+        case OP_ADD:
+            fprintf(out, "    if (IS_ANY_STRING(s%d) && IS_ANY_STRING(s%d)) {\n", top - 1, top);
+            fprintf(out, "        if (!concatenate(vm, s%d, s%d, &s%d)) {\n", top - 1, top, top - 1);
+            fprintf(out, "            return aotError(%d, \"String is too long.\");\n", line);
+            fprintf(out, "        }\n");
+            emitArithmetic(out, top - 1, top, line, "addInts", '+',
+                "Operands must be two numbers or two strings.", true);
+            break;
+        case OP_SUBTRACT:
+            emitArithmetic(out, top - 1, top, line, "subtractInts", '-', "Operands must be numbers.", false);
+            break;
+        case OP_MULTIPLY:
+            emitArithmetic(out, top - 1, top, line, "multiplyInts", '*', "Operands must be numbers.", false);
+            break;
+        case OP_DIVIDE:
+            fprintf(out, "    if (!IS_NUMERIC(s%d) || !IS_NUMERIC(s%d)) {\n", top - 1, top);
+            fprintf(out, "        return aotError(%d, \"Operands must be numbers.\");\n", line);
+            fprintf(out, "    }\n");
+            fprintf(out, "    s%d = NUMBER_VAL(AS_DOUBLE(s%d) / AS_DOUBLE(s%d));\n", top - 1, top - 1, top);
+            break;
+        case OP_NOT:
+            fprintf(out, "    s%d = BOOL_VAL(IS_NIL(s%d) || (IS_BOOL(s%d) && !AS_BOOL(s%d)));\n",
+                top, top, top, top);
+            break;
+        case OP_NEGATE:
+            fprintf(out, "    if (IS_INT(s%d)) {\n", top);
+            fprintf(out, "        s%d = negateInt(AS_INT(s%d));\n", top, top);
+            fprintf(out, "    } else if (IS_NUMBER(s%d)) {\n", top);
+            fprintf(out, "        s%d = NUMBER_VAL(-AS_NUMBER(s%d));\n", top, top);
+            fprintf(out, "    } else {\n");
+            fprintf(out, "        return aotError(%d, \"Operand must be a number.\");\n", line);
+            fprintf(out, "    }\n");
+            break;
+        case OP_CALL: {
+            int argCount = chunk->code[offset + 1];
+            int callee = top - argCount;
+            reachable = emitCall(out, chunk, constantOf, callee, argCount, line);
+            depth -= argCount;
+            break;
+        }
+        case OP_POP:
+            break;
+        case OP_DEFINE_GLOBAL: {
+            int slot = globalOperand(chunk, offset);
+            fprintf(out, "    g%d = s%d;\n", slot, top);
+            globals[slot] = (GlobalState) { .defined = true, .constant = constantOf[top] };
+            break;
+        }
+        case OP_GET_GLOBAL: {
+            int slot = globalOperand(chunk, offset);
+            if (!globals[slot].defined) {
+                emitUndefined(out, vm, slot, line);
+                reachable = false;
+                break;
+            }
+            fprintf(out, "    s%d = g%d;\n", depth, slot);
+            break;
+        }
+        case OP_SET_GLOBAL: {
+            int slot = globalOperand(chunk, offset);
+            if (!globals[slot].defined) {
+                emitUndefined(out, vm, slot, line);
+                reachable = false;
+                break;
+            }
+            fprintf(out, "    g%d = s%d;\n", slot, top);
+            globals[slot].constant = constantOf[top];
+            break;
+        }
+        case OP_RETURN:
+            fprintf(out, "    writeValue(&vm->out, s%d);\n", top);
+            fprintf(out, "    writeOutput(&vm->out, \"\\n\", 1);\n");
+            fprintf(out, "    return INTERPRET_OK;\n");
+            reachable = false;
+            break;
+        default:
+            FREE_ARRAY(&systemHeap, int, constantOf, chunk->maxStack + 1);
+            FREE_ARRAY(&systemHeap, GlobalState, globals, vm->globals.count + 1);
+            return false;
+        }
+
+        // Anything computed is not a constant, and so never a native.
+        const OpInfo* info = &opInfo[opcode];
+        depth += info->pushes - info->pops;
+        if (opcode == OP_GET_GLOBAL) {
+            constantOf[depth - 1] = globals[globalOperand(chunk, offset)].constant;
+        } else if (opcode != OP_CONSTANT && opcode != OP_SET_GLOBAL && info->pushes > 0) {
+            constantOf[depth - 1] = -1;
+        }
+        offset += 1 + info->operandBytes;
+    }
+    FREE_ARRAY(&systemHeap, int, constantOf, chunk->maxStack + 1);
+    FREE_ARRAY(&systemHeap, GlobalState, globals, vm->globals.count + 1);
+
+    fprintf(out, "}\n\n");
+    fprintf(out, "int main(void)\n{\n    return aotMain(script);\n}\n");
+    return true;
+}
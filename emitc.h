@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "chunk.h"
+#include "vm.h"
+
+// Translates a verified chunk, compiled in `vm`, into a standalone C program
+// that evaluates it without a dispatch loop. See aot.h for how the result is
+// built. Returns false if the chunk uses an instruction the translator does
+// not know.
+bool emitC(VM* vm, Chunk* chunk, const char* scriptName, FILE* out);
@@ -0,0 +1,190 @@
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "cache.h"
+#include "globals.h"
+#include "memory.h"
+
+#define GROUP_WIDTH 16
+#define CONTROL_EMPTY 0x80
+
+void initGlobals(Globals* globals, Heap* heap)
+{
+    *globals = (Globals) {
+        .heap = heap,
+        .control = NULL,
+        .entries = NULL,
+        .capacity = 0,
+        .count = 0,
+        .slotCapacity = 0,
+        .values = NULL,
+        .names = NULL,
+    };
+}
+
+void freeGlobals(Globals* globals)
+{
+    for (int i = 0; i < globals->count; i++) {
+        FREE_ARRAY(globals->heap, char, globals->names[i].chars, globals->names[i].length);
+    }
+    FREE_ARRAY(globals->heap, uint8_t, globals->control, globals->capacity);
+    FREE_ARRAY(globals->heap, uint16_t, globals->entries, globals->capacity);
+    FREE_ARRAY(globals->heap, Value, globals->values, globals->slotCapacity);
+    FREE_ARRAY(globals->heap, GlobalName, globals->names, globals->slotCapacity);
+    initGlobals(globals, globals->heap);
+}
+
+// Bit i of the result is set if control byte i of the group equals `byte`.
+static uint32_t matchGroup(const uint8_t* group, uint8_t byte)
+{
+#ifdef __SSE2__
+    __m128i bytes = _mm_loadu_si128((const __m128i*)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8((char)byte)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < GROUP_WIDTH; i++) {
+        mask |= (uint32_t)(group[i] == byte) << i;
+    }
+    return mask;
+#endif
+}
+
+static uint8_t tagOf(uint64_t hash)
+{
+    return (uint8_t)(hash >> 57);
+}
+
+// Walks the probe sequence of `hash` and returns the slot of the name, or -1
+// with *empty set to the first empty entry on the way. The group number
+// advances by 1, 2, 3, ..., which visits every group of a power-of-two
+// table.
+static int probe(Globals* globals, const char* name, int length, uint64_t hash, int* empty)
+{
+    size_t groupMask = (size_t)globals->capacity / GROUP_WIDTH - 1;
+    size_t group = hash & groupMask;
+    uint8_t tag = tagOf(hash);
+
+    for (size_t step = 1;; step++) {
+        const uint8_t* control = globals->control + group * GROUP_WIDTH;
+        for (uint32_t matches = matchGroup(control, tag); matches != 0; matches &= matches - 1) {
+            int slot = globals->entries[group * GROUP_WIDTH + __builtin_ctz(matches)];
+            GlobalName* candidate = &globals->names[slot];
+            if (candidate->length == length && memcmp(candidate->chars, name, length) == 0) {
+                return slot;
+            }
+        }
+
+        uint32_t empties = matchGroup(control, CONTROL_EMPTY);
+        if (empties != 0) {
+            *empty = (int)(group * GROUP_WIDTH + __builtin_ctz(empties));
+            return -1;
+        }
+        group = (group + step) & groupMask;
+    }
+}
+
+int findGlobal(Globals* globals, const char* name, int length)
+{
+    if (globals->capacity == 0) {
+        return -1;
+    }
+    int empty;
+    return probe(globals, name, length, hashSource(name, length), &empty);
+}
+
+static void placeEntry(Globals* globals, int index, uint64_t hash, int slot)
+{
+    globals->control[index] = tagOf(hash);
+    globals->entries[index] = (uint16_t)slot;
+}
+
+// Rebuilds the table at twice the size. The new arrays are allocated before
+// the old ones are touched, so a failed allocation leaves the table intact.
+static void growTable(Globals* globals)
+{
+    int capacity = globals->capacity == 0 ? GROUP_WIDTH : globals->capacity * 2;
+    reserveHeap(globals->heap, capacity * (sizeof(uint8_t) + sizeof(uint16_t)));
+    uint8_t* control = ALLOCATE(globals->heap, uint8_t, capacity);
+    uint16_t* entries = ALLOCATE(globals->heap, uint16_t, capacity);
+
+    FREE_ARRAY(globals->heap, uint8_t, globals->control, globals->capacity);
+    FREE_ARRAY(globals->heap, uint16_t, globals->entries, globals->capacity);
+    memset(control, CONTROL_EMPTY, capacity);
+    globals->control = control;
+    globals->entries = entries;
+    globals->capacity = capacity;
+
+    for (int slot = 0; slot < globals->count; slot++) {
+        GlobalName* name = &globals->names[slot];
+        int empty;
+        probe(globals, name->chars, name->length, name->hash, &empty);
+        placeEntry(globals, empty, name->hash, slot);
+    }
+}
+
+int declareGlobal(Globals* globals, const char* name, int length)
+{
+    uint64_t hash = hashSource(name, length);
+    int empty = -1;
+    if (globals->capacity > 0) {
+        int slot = probe(globals, name, length, hash, &empty);
+        if (slot >= 0) {
+            return slot;
+        }
+    }
+    if (globals->count == GLOBALS_MAX) {
+        return -1;
+    }
+
+    if (globals->slotCapacity < globals->count + 1) {
+        int oldCapacity = globals->slotCapacity;
+        int capacity = GROW_CAPACITY(oldCapacity);
+        reserveHeap(globals->heap, (capacity - oldCapacity) * (sizeof(Value) + sizeof(GlobalName)));
+        globals->values = GROW_ARRAY(globals->heap, globals->values, Value, oldCapacity, capacity);
+        globals->names = GROW_ARRAY(globals->heap, globals->names, GlobalName, oldCapacity, capacity);
+        globals->slotCapacity = capacity;
+    }
+    // Keep at least one entry in eight empty so that probes stay short.
+    if ((globals->count + 1) * 8 > globals->capacity * 7) {
+        growTable(globals);
+        probe(globals, name, length, hash, &empty);
+    }
+    char* chars = ALLOCATE(globals->heap, char, length);
+    memcpy(chars, name, length);
+
+    int slot = globals->count++;
+    globals->names[slot] = (GlobalName) { .chars = chars, .length = length, .hash = hash };
+    globals->values[slot] = UNDEFINED_VAL;
+    placeEntry(globals, empty, hash, slot);
+    return slot;
+}
+
+// There are no tombstones, so the remaining names are placed again in an
+// emptied table of the same size.
+void forgetGlobals(Globals* globals, int count)
+{
+    if (count >= globals->count) {
+        return;
+    }
+    for (int slot = count; slot < globals->count; slot++) {
+        FREE_ARRAY(globals->heap, char, globals->names[slot].chars, globals->names[slot].length);
+    }
+    globals->count = count;
+
+    memset(globals->control, CONTROL_EMPTY, globals->capacity);
+    for (int slot = 0; slot < count; slot++) {
+        GlobalName* name = &globals->names[slot];
+        int empty;
+        probe(globals, name->chars, name->length, name->hash, &empty);
+        placeEntry(globals, empty, name->hash, slot);
+    }
+}
+
+void resetGlobals(Globals* globals)
+{
+    for (int i = 0; i < globals->count; i++) {
+        globals->values[i] = UNDEFINED_VAL;
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "allocator.h"
+#include "common.h"
+#include "value.h"
+
+// Instructions name a global with two operand bytes.
+#define GLOBALS_MAX (UINT16_MAX + 1)
+
+// What a global holds between being declared and being defined. No real
+// value is an object pointer to NULL.
+#define UNDEFINED_VAL OBJ_VAL(NULL)
+#define IS_UNDEFINED(value) (IS_OBJ(value) && AS_OBJ(value) == NULL)
+
+typedef struct {
+    char* chars; // owned by the table, not NUL-terminated
+    int length;
+    uint64_t hash;
+} GlobalName;
+
+// Global variables. Each name gets a slot, a dense index into `values` that
+// never changes, so the compiler looks a name up once and the instructions
+// it emits index `values` directly.
+//
+// Names are found through a Swiss table: `control` holds one byte per entry,
+// either CONTROL_EMPTY or the top seven bits of the name's hash, in groups of
+// sixteen that are compared against the wanted tag all at once. Only entries
+// whose tag matches are compared by name. Globals are never removed, so
+// there are no tombstones and a probe ends at the first group with an empty
+// entry.
+typedef struct {
+    Heap* heap;
+    uint8_t* control;
+    uint16_t* entries; // the slot each occupied entry maps to
+    int capacity; // entries: zero or a power of two of at least a group
+    int count; // slots in use
+    int slotCapacity;
+    Value* values;
+    GlobalName* names;
+} Globals;
+
+void initGlobals(Globals* globals, Heap* heap);
+void freeGlobals(Globals* globals);
+// Returns the slot of `name`, or -1 if it has none.
+int findGlobal(Globals* globals, const char* name, int length);
+// Returns the slot of `name`, giving it a new, undefined one if needed.
+// Returns -1 if all GLOBALS_MAX slots are taken.
+int declareGlobal(Globals* globals, const char* name, int length);
+// Drops the slots from `count` on, which a compile that failed declared.
+// Nothing may refer to them.
+void forgetGlobals(Globals* globals, int count);
+// Makes every global undefined again. Slots and names are kept, so chunks
+// compiled against the table stay valid.
+void resetGlobals(Globals* globals);
@@ -0,0 +1,173 @@
+#define _GNU_SOURCE
+
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+
+#include "latency.h"
+#include "memory.h"
+
+static const char* phaseNames[LATENCY_PHASE_COUNT] = {
+    [LATENCY_COMPILE] = "compile",
+    [LATENCY_EXECUTE] = "execute",
+    [LATENCY_TEARDOWN] = "teardown",
+};
+
+static const char* resultNames[LATENCY_RESULT_COUNT] = {
+    "ok",
+    "compile error",
+    "runtime error",
+    "yield",
+};
+
+static volatile sig_atomic_t signalled = 0;
+
+void initLatencyStats(LatencyStats* stats, Heap* heap)
+{
+    stats->heap = heap;
+    stats->phases = ALLOCATE(heap, LatencyHistogram, LATENCY_PHASE_COUNT);
+    resetLatencyStats(stats);
+}
+
+void freeLatencyStats(LatencyStats* stats)
+{
+    FREE_ARRAY(stats->heap, LatencyHistogram, stats->phases, LATENCY_PHASE_COUNT);
+    stats->phases = NULL;
+}
+
+void resetLatencyStats(LatencyStats* stats)
+{
+    memset(stats->phases, 0, sizeof(LatencyHistogram) * LATENCY_PHASE_COUNT);
+    for (int phase = 0; phase < LATENCY_PHASE_COUNT; phase++) {
+        stats->phases[phase].min = UINT64_MAX;
+    }
+    stats->evaluations = 0;
+    memset(stats->results, 0, sizeof(stats->results));
+}
+
+uint64_t latencyNow(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static int bucketIndex(uint64_t value)
+{
+    const int sub = LATENCY_SUB_BUCKET_BITS;
+    if (value < (1u << sub)) {
+        return (int)value;
+    }
+    int msb = 63 - __builtin_clzll(value);
+    if (msb >= LATENCY_MAX_BITS) {
+        return LATENCY_BUCKET_COUNT - 1;
+    }
+    // The top `sub` bits of the value, including its leading one.
+    int mantissa = (int)(value >> (msb - (sub - 1)));
+    return (1 << sub) + (msb - sub) * (1 << (sub - 1)) + (mantissa - (1 << (sub - 1)));
+}
+
+// The largest value that falls into `index`.
+static uint64_t bucketLimit(int index)
+{
+    const int sub = LATENCY_SUB_BUCKET_BITS;
+    if (index < (1 << sub)) {
+        return (uint64_t)index;
+    }
+    int octave = (index - (1 << sub)) / (1 << (sub - 1));
+    int mantissa = (index - (1 << sub)) % (1 << (sub - 1)) + (1 << (sub - 1));
+    int shift = octave + 1;
+    return (((uint64_t)mantissa + 1) << shift) - 1;
+}
+
+void recordLatency(LatencyStats* stats, LatencyPhase phase, uint64_t nanos)
+{
+    LatencyHistogram* histogram = &stats->phases[phase];
+    histogram->count++;
+    histogram->total += nanos;
+    if (nanos < histogram->min) {
+        histogram->min = nanos;
+    }
+    if (nanos > histogram->max) {
+        histogram->max = nanos;
+    }
+    histogram->buckets[bucketIndex(nanos)]++;
+}
+
+uint64_t latencyPercentile(const LatencyHistogram* histogram, double percentile)
+{
+    if (histogram->count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(percentile / 100.0 * (double)histogram->count + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKET_COUNT; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= rank) {
+            uint64_t limit = bucketLimit(i);
+            return limit < histogram->max ? limit : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+static void reportMicros(FILE* file, uint64_t nanos)
+{
+    fprintf(file, " %11.3f", (double)nanos / 1000.0);
+}
+
+void reportLatency(LatencyStats* stats, FILE* file)
+{
+    fprintf(file, "%-10s %10s %11s %11s %11s %11s %11s %11s %11s\n", "phase (us)",
+        "count", "min", "mean", "p50", "p90", "p99", "p99.9", "max");
+    for (int phase = 0; phase < LATENCY_PHASE_COUNT; phase++) {
+        LatencyHistogram* histogram = &stats->phases[phase];
+        fprintf(file, "%-10s %10llu", phaseNames[phase], (unsigned long long)histogram->count);
+        if (histogram->count == 0) {
+            fprintf(file, "\n");
+            continue;
+        }
+        reportMicros(file, histogram->min);
+        reportMicros(file, histogram->total / histogram->count);
+        reportMicros(file, latencyPercentile(histogram, 50.0));
+        reportMicros(file, latencyPercentile(histogram, 90.0));
+        reportMicros(file, latencyPercentile(histogram, 99.0));
+        reportMicros(file, latencyPercentile(histogram, 99.9));
+        reportMicros(file, histogram->max);
+        fprintf(file, "\n");
+    }
+
+    fprintf(file, "evaluations %llu:", (unsigned long long)stats->evaluations);
+    for (int result = 0; result < LATENCY_RESULT_COUNT; result++) {
+        fprintf(file, " %s %llu%s", resultNames[result], (unsigned long long)stats->results[result],
+            result < LATENCY_RESULT_COUNT - 1 ? "," : "\n");
+    }
+}
+
+static void onSignal(int signal)
+{
+    (void)signal;
+    signalled = 1;
+}
+
+void installLatencySignal(void)
+{
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onSignal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &action, NULL);
+}
+
+bool takeLatencySignal(void)
+{
+    if (!signalled) {
+        return false;
+    }
+    signalled = 0;
+    return true;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "allocator.h"
+#include "common.h"
+
+// Values below 2^LATENCY_SUB_BUCKET_BITS nanoseconds get a bucket each;
+// above that every power of two is split into 2^(bits - 1) buckets, so a
+// recorded value is off by less than 1/64 of itself.
+#define LATENCY_SUB_BUCKET_BITS 7
+#define LATENCY_MAX_BITS 42 // about 73 minutes; longer samples are clamped
+#define LATENCY_BUCKET_COUNT \
+    ((1 << LATENCY_SUB_BUCKET_BITS) + (LATENCY_MAX_BITS - LATENCY_SUB_BUCKET_BITS) * (1 << (LATENCY_SUB_BUCKET_BITS - 1)))
+
+typedef enum {
+    LATENCY_COMPILE, // cache lookup, scanning, compiling and verifying
+    LATENCY_EXECUTE, // one run() call, so each fuel slice counts separately
+    LATENCY_TEARDOWN, // freeing the finished chunk
+    LATENCY_PHASE_COUNT
+} LatencyPhase;
+
+// A log-linear histogram of nanosecond samples, in the style of
+// HdrHistogram.
+typedef struct {
+    uint64_t count;
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    uint64_t buckets[LATENCY_BUCKET_COUNT];
+} LatencyHistogram;
+
+// Result codes match InterpretResult.
+#define LATENCY_RESULT_COUNT 4
+
+typedef struct {
+    Heap* heap;
+    LatencyHistogram* phases; // LATENCY_PHASE_COUNT histograms
+    uint64_t evaluations; // interpret() and interpretWithFuel() calls
+    uint64_t results[LATENCY_RESULT_COUNT]; // returns, resumes included
+} LatencyStats;
+
+void initLatencyStats(LatencyStats* stats, Heap* heap);
+void freeLatencyStats(LatencyStats* stats);
+void resetLatencyStats(LatencyStats* stats);
+uint64_t latencyNow(void);
+void recordLatency(LatencyStats* stats, LatencyPhase phase, uint64_t nanos);
+// The smallest recorded value, rounded to its bucket, that at least
+// `percentile` percent of the samples do not exceed. 0 if there are none.
+uint64_t latencyPercentile(const LatencyHistogram* histogram, double percentile);
+void reportLatency(LatencyStats* stats, FILE* file);
+
+// Makes SIGUSR1 request a report, which the VM writes to stderr at the end of
+// the next evaluation. Reporting from the handler itself would not be
+// async-signal-safe.
+void installLatencySignal(void);
+// True once per received signal.
+bool takeLatencySignal(void);
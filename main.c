@@ -1,6 +1,18 @@
+#define _GNU_SOURCE
+
 #include "chunk.h"
 #include "common.h"
+#include "compiler.h"
 #include "debug.h"
+#include "emitc.h"
+#include "latency.h"
+#include "memory.h"
+#include "perf.h"
+#include "profile.h"
+#include "serialize.h"
+#include "server.h"
+#include "sheet.h"
+#include "trace.h"
 #include "vm.h"
 // #include <emscripten/emscripten.h>
 #include <stdio.h>
@@ -11,6 +23,7 @@ static void repl(VM* vm)
 {
     char line[1024];
     for (;;) {
+        flushOutput(&vm->out);
         printf("> ");
 
         if (!fgets(line, sizeof(line), stdin)) {
@@ -44,38 +57,344 @@ static char* readFile(const char* path)
         fprintf(stderr, "Could not read file \"%s\".\n", path);
         exit(74);
     }
-    buffer[bytesRead] = '\n';
+    buffer[bytesRead] = '\0';
 
     fclose(file);
     return buffer;
 }
 
-static void runFile(VM* vm, const char* path)
+static int exitCode(InterpretResult result)
+{
+    if (result == INTERPRET_COMPILE_ERROR)
+        return 65;
+    if (result == INTERPRET_RUNTIME_ERROR)
+        return 70;
+    return 0;
+}
+
+static int runFile(VM* vm, const char* path)
 {
     char* source = readFile(path);
     InterpretResult result = interpret(vm, source);
     free(source);
+    flushOutput(&vm->out);
 
-    if (result == INTERPRET_COMPILE_ERROR)
-        exit(65);
-    if (result == INTERPRET_RUNTIME_ERROR)
-        exit(70);
+    return exitCode(result);
+}
+
+static void printCell(VM* vm, Sheet* sheet, int cell)
+{
+    GlobalName* name = &vm->globals.names[sheet->cells[cell].slot];
+    Value value = cellValue(sheet, cell);
+    writeOutput(&vm->out, name->chars, name->length);
+    if (IS_UNDEFINED(value)) {
+        writeOutput(&vm->out, " is undefined\n", 14);
+        return;
+    }
+    writeOutput(&vm->out, " = ", 3);
+    writeValue(&vm->out, value);
+    writeOutput(&vm->out, "\n", 1);
+}
+
+// Sets the cell a `name: expression` line describes. Blank lines are
+// skipped. The line must be NUL-terminated.
+static bool setCellFromLine(Sheet* sheet, char* line)
+{
+    while (*line == ' ' || *line == '\t') {
+        line++;
+    }
+    if (*line == '\0' || *line == '\n') {
+        return true;
+    }
+    char* colon = strchr(line, ':');
+    if (colon == NULL) {
+        fprintf(stderr, "Expect 'name: expression', got '%s'.\n", line);
+        return false;
+    }
+    int length = (int)(colon - line);
+    while (length > 0 && (line[length - 1] == ' ' || line[length - 1] == '\t')) {
+        length--;
+    }
+    return setCell(sheet, line, length, colon + 1);
+}
+
+// A spreadsheet: every line of the file, and then every line read from
+// stdin, sets a cell. After the file and after each line from stdin, the
+// cells whose value changed are printed.
+static int runSheet(VM* vm, const char* path)
+{
+    Sheet sheet;
+    initSheet(&sheet, vm);
+    char* source = readFile(path);
+    bool loaded = true;
+    for (char* line = source; line != NULL && *line != '\0';) {
+        char* end = strchr(line, '\n');
+        if (end != NULL) {
+            *end = '\0';
+        }
+        loaded = setCellFromLine(&sheet, line) && loaded;
+        line = end == NULL ? NULL : end + 1;
+    }
+    free(source);
+    if (!loaded) {
+        freeSheet(&sheet);
+        return 65;
+    }
+
+    InterpretResult result = recalculate(&sheet);
+    for (int i = 0; i < sheet.changedCount; i++) {
+        printCell(vm, &sheet, sheet.changed[i]);
+    }
+    flushOutput(&vm->out);
+
+    char* line = NULL;
+    size_t capacity = 0;
+    while (getline(&line, &capacity, stdin) > 0) {
+        line[strcspn(line, "\n")] = '\0';
+        if (!setCellFromLine(&sheet, line)) {
+            continue;
+        }
+        result = recalculate(&sheet);
+        for (int i = 0; i < sheet.changedCount; i++) {
+            printCell(vm, &sheet, sheet.changed[i]);
+        }
+        flushOutput(&vm->out);
+    }
+    free(line);
+    freeSheet(&sheet);
+    return exitCode(result);
+}
+
+static void saveTrace(VM* vm, const char* path)
+{
+    FILE* file = fopen(path, "wb");
+    if (file == NULL || !writeTrace(&vm->tracer, file)) {
+        fprintf(stderr, "Could not write trace \"%s\".\n", path);
+    }
+    if (file != NULL) {
+        fclose(file);
+    }
+}
+
+static void saveProfile(const char* path, const char* root)
+{
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Could not write profile \"%s\".\n", path);
+        return;
+    }
+    writeProfile(file, root);
+    fclose(file);
+}
+
+// Traces only record instruction offsets, so decoding recompiles the script
+// that produced them and disassembles against the fresh chunk.
+static int decodeTraceFile(VM* vm, const char* tracePath, const char* path)
+{
+    char* source = readFile(path);
+    Chunk chunk;
+    initChunk(&chunk, &vm->heap);
+    bool compiled = compile(vm, source, &chunk);
+    free(source);
+    if (!compiled) {
+        freeChunk(&chunk);
+        return 65;
+    }
+
+    FILE* file = fopen(tracePath, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open file \"%s\".\n", tracePath);
+        exit(74);
+    }
+    bool decoded = decodeTrace(file, &chunk);
+    fclose(file);
+    freeChunk(&chunk);
+
+    if (!decoded) {
+        fprintf(stderr, "Could not decode trace \"%s\".\n", tracePath);
+        return 65;
+    }
+    return 0;
+}
+
+// Writes the chunk image that `--serve` accepts in place of source text.
+static int compileToFile(VM* vm, const char* path, const char* imagePath)
+{
+    char* source = readFile(path);
+    Chunk chunk;
+    initChunk(&chunk, &vm->heap);
+    bool compiled = compile(vm, source, &chunk);
+    free(source);
+    if (!compiled) {
+        freeChunk(&chunk);
+        return 65;
+    }
+
+    size_t length;
+    uint8_t* image = serializeChunk(vm, &chunk, &length);
+    freeChunk(&chunk);
+
+    FILE* file = fopen(imagePath, "wb");
+    bool written = file != NULL && fwrite(image, 1, length, file) == length;
+    if (file != NULL && fclose(file) != 0) {
+        written = false;
+    }
+    FREE_ARRAY(&vm->heap, uint8_t, image, length);
+    if (!written) {
+        fprintf(stderr, "Could not write chunk image \"%s\".\n", imagePath);
+        return 74;
+    }
+    return 0;
+}
+
+// Writes a C translation of the script; see aot.h for building it.
+static int emitCFile(VM* vm, const char* path, const char* outputPath)
+{
+    char* source = readFile(path);
+    Chunk chunk;
+    initChunk(&chunk, &vm->heap);
+    bool compiled = compile(vm, source, &chunk);
+    free(source);
+    if (!compiled) {
+        freeChunk(&chunk);
+        return 65;
+    }
+
+    FILE* file = fopen(outputPath, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open file \"%s\".\n", outputPath);
+        freeChunk(&chunk);
+        return 74;
+    }
+    bool emitted = emitC(vm, &chunk, path, file);
+    bool written = fclose(file) == 0;
+    freeChunk(&chunk);
+    if (!emitted) {
+        fprintf(stderr, "Could not translate \"%s\" to C.\n", path);
+        return 65;
+    }
+    if (!written) {
+        fprintf(stderr, "Could not write \"%s\".\n", outputPath);
+        return 74;
+    }
+    return 0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: clox [--trace file] [--profile file] [--perf-counters] [--latency] [--registers] [path]\n");
+    fprintf(stderr, "       clox --decode-trace file path\n");
+    fprintf(stderr, "       clox --compile image path\n");
+    fprintf(stderr, "       clox --emit-c file.c path\n");
+    fprintf(stderr, "       clox --serve socket\n");
+    fprintf(stderr, "       clox --sheet path\n");
+    exit(64);
 }
 
 int main(int argc, const char* argv[])
 {
+    const char* tracePath = NULL;
+    const char* profilePath = NULL;
+    const char* decodePath = NULL;
+    const char* imagePath = NULL;
+    const char* cPath = NULL;
+    const char* socketPath = NULL;
+    bool sheet = false;
+    bool perfCounters = false;
+    bool latency = false;
+    bool registers = false;
+
+    int arg = 1;
+    for (; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++) {
+        if (strcmp(argv[arg], "--trace") == 0 && arg + 1 < argc) {
+            tracePath = argv[++arg];
+        } else if (strcmp(argv[arg], "--profile") == 0 && arg + 1 < argc) {
+            profilePath = argv[++arg];
+        } else if (strcmp(argv[arg], "--decode-trace") == 0 && arg + 1 < argc) {
+            decodePath = argv[++arg];
+        } else if (strcmp(argv[arg], "--compile") == 0 && arg + 1 < argc) {
+            imagePath = argv[++arg];
+        } else if (strcmp(argv[arg], "--emit-c") == 0 && arg + 1 < argc) {
+            cPath = argv[++arg];
+        } else if (strcmp(argv[arg], "--serve") == 0 && arg + 1 < argc) {
+            socketPath = argv[++arg];
+        } else if (strcmp(argv[arg], "--sheet") == 0) {
+            sheet = true;
+        } else if (strcmp(argv[arg], "--perf-counters") == 0) {
+            perfCounters = true;
+        } else if (strcmp(argv[arg], "--latency") == 0) {
+            latency = true;
+        } else if (strcmp(argv[arg], "--registers") == 0) {
+            registers = true;
+        } else {
+            usage();
+        }
+    }
+
     VM vm;
     initVM(&vm);
-    if (argc == 1) {
+    installLatencySignal();
+    vm.useRegisters = registers;
+    if (tracePath != NULL) {
+        enableTracing(&vm.tracer, TRACE_DEFAULT_CAPACITY, true);
+    }
+    if (profilePath != NULL && !startProfiler(&vm.site, PROFILE_DEFAULT_HZ)) {
+        perror("Could not start the profiler");
+        profilePath = NULL;
+    }
+    PerfCounters perf;
+    if (perfCounters) {
+        if (!initPerfCounters(&perf)) {
+            fprintf(stderr, "Hardware performance counters are unavailable.\n");
+        }
+        vm.perf = &perf;
+    }
+
+    int status = 0;
+    if (socketPath != NULL) {
+        if (arg != argc)
+            usage();
+        status = serve(socketPath);
+    } else if (sheet) {
+        if (arg + 1 != argc)
+            usage();
+        status = runSheet(&vm, argv[arg]);
+    } else if (cPath != NULL) {
+        if (arg + 1 != argc)
+            usage();
+        status = emitCFile(&vm, argv[arg], cPath);
+    } else if (imagePath != NULL) {
+        if (arg + 1 != argc)
+            usage();
+        status = compileToFile(&vm, argv[arg], imagePath);
+    } else if (decodePath != NULL) {
+        if (arg + 1 != argc)
+            usage();
+        status = decodeTraceFile(&vm, decodePath, argv[arg]);
+    } else if (arg == argc) {
         repl(&vm);
-    } else if (argc == 2) {
-        runFile(&vm, argv[1]);
+    } else if (arg + 1 == argc) {
+        status = runFile(&vm, argv[arg]);
     } else {
-        fprintf(stderr, "Usage: clox [path]\n");
-        return 64;
+        usage();
+    }
+
+    if (tracePath != NULL) {
+        saveTrace(&vm, tracePath);
+    }
+    if (profilePath != NULL) {
+        stopProfiler();
+        saveProfile(profilePath, arg < argc ? argv[arg] : "clox");
+    }
+    if (perfCounters) {
+        reportPerfCounters(&perf, stderr);
+        freePerfCounters(&perf);
+    }
+    if (latency) {
+        reportLatency(&vm.latency, stderr);
     }
     freeVM(&vm);
-    return 0;
+    return status;
 }
 
 // void EMSCRIPTEN_KEEPALIVE browserRepl(const char* line)
@@ -1,3 +1,4 @@
+#include <stdio.h>
 #include <stdlib.h>
 
 #include "common.h"
@@ -5,23 +6,123 @@
 #include "object.h"
 #include "vm.h"
 
-void* reallocate(void* previous, size_t oldSize, size_t newSize)
+static void* systemAllocate(void* userData, size_t size)
 {
+    (void)userData;
+    return malloc(size);
+}
+
+static void* systemReallocate(void* userData, void* pointer, size_t oldSize, size_t newSize)
+{
+    (void)userData;
+    (void)oldSize;
+    return realloc(pointer, newSize);
+}
+
+static void systemFree(void* userData, void* pointer, size_t size)
+{
+    (void)userData;
+    (void)size;
+    free(pointer);
+}
+
+const Allocator systemAllocator = {
+    .allocate = systemAllocate,
+    .reallocate = systemReallocate,
+    .free = systemFree,
+    .userData = NULL,
+};
+
+Heap systemHeap = {
+    .allocator = {
+        .allocate = systemAllocate,
+        .reallocate = systemReallocate,
+        .free = systemFree,
+        .userData = NULL,
+    },
+    .shared = true,
+};
+
+void initHeap(Heap* heap, const Allocator* allocator)
+{
+    *heap = (Heap) {
+        .allocator = *allocator,
+        .bytes = 0,
+        .peak = 0,
+        .limit = 0,
+        .frozen = false,
+        .recover = NULL,
+        .shared = false,
+    };
+}
+
+static void outOfMemory(Heap* heap)
+{
+    if (heap->recover != NULL) {
+        longjmp(*heap->recover, 1);
+    }
+    fprintf(stderr, "Out of memory.\n");
+    abort();
+}
+
+void reserveHeap(Heap* heap, size_t bytes)
+{
+    if (heap->recover != NULL
+        && (heap->frozen || (heap->limit != 0 && heap->bytes + bytes > heap->limit))) {
+        outOfMemory(heap);
+    }
+}
+
+// Sizes are unsigned, so a shrink is a wrapping add.
+static void account(Heap* heap, size_t delta)
+{
+    if (heap->shared) {
+        __atomic_add_fetch(&heap->bytes, delta, __ATOMIC_RELAXED);
+        return;
+    }
+    heap->bytes += delta;
+    if (heap->bytes > heap->peak) {
+        heap->peak = heap->bytes;
+    }
+}
+
+void* reallocate(Heap* heap, void* previous, size_t oldSize, size_t newSize)
+{
+    Allocator* allocator = &heap->allocator;
     if (newSize == 0) {
-        free(previous);
+        if (previous != NULL) {
+            allocator->free(allocator->userData, previous, oldSize);
+            account(heap, -oldSize);
+        }
         return NULL;
     }
 
-    return realloc(previous, newSize);
+    if (newSize > oldSize) {
+        reserveHeap(heap, newSize - oldSize);
+    }
+    void* result = previous == NULL
+        ? allocator->allocate(allocator->userData, newSize)
+        : allocator->reallocate(allocator->userData, previous, oldSize, newSize);
+    if (result == NULL) {
+        outOfMemory(heap);
+    }
+    account(heap, newSize - oldSize);
+    return result;
 }
 
-static void freeObject(Obj* object)
+void freeObject(VM* vm, Obj* object)
 {
-    switch (object->type) {
+    Heap* heap = &vm->heap;
+    switch (objType(object)) {
+    case OBJ_NATIVE:
+        FREE(heap, ObjNative, object);
+        break;
     case OBJ_STRING: {
         ObjString* string = (ObjString*)object;
-        FREE_ARRAY(char, string->chars, string->length + 1);
-        FREE(ObjString, object);
+        if (string->chars != NULL) {
+            FREE_ARRAY(heap, char, string->chars, string->length + 1);
+        }
+        FREE(heap, ObjString, object);
         break;
     }
     default:
@@ -33,8 +134,8 @@ void freeObjects(VM* vm)
 {
     Obj* object = vm->objects;
     while (object != NULL) {
-        Obj* next = object->next;
-        freeObject(object);
+        Obj* next = objNext(object);
+        freeObject(vm, object);
         object = next;
     }
 }
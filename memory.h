@@ -1,21 +1,28 @@
 #pragma once
 
+#include "allocator.h"
 #include "vm.h"
 
-#define ALLOCATE(type, count) \
-    (type*)reallocate(NULL, 0, sizeof(type) * (count))
+#define ALLOCATE(heap, type, count) \
+    (type*)reallocate(heap, NULL, 0, sizeof(type) * (count))
 
-#define FREE(type, pointer) reallocate(pointer, sizeof(type), 0)
+#define FREE(heap, type, pointer) reallocate(heap, pointer, sizeof(type), 0)
 
 #define GROW_CAPACITY(capacity) \
     ((capacity) < 8 ? 8 : (capacity)*2)
 
-#define GROW_ARRAY(previous, type, oldCount, count)        \
-    (type*)reallocate(previous, sizeof(type) * (oldCount), \
+#define GROW_ARRAY(heap, previous, type, oldCount, count)        \
+    (type*)reallocate(heap, previous, sizeof(type) * (oldCount), \
         sizeof(type) * (count))
 
-#define FREE_ARRAY(type, pointer, oldCount) \
-    reallocate(pointer, sizeof(type) * oldCount, 0)
+#define FREE_ARRAY(heap, type, pointer, oldCount) \
+    reallocate(heap, pointer, sizeof(type) * (oldCount), 0)
 
-void* reallocate(void* previous, size_t oldSize, size_t newSize);
-void freeObjects(VM* vm);
\ No newline at end of file
+void* reallocate(Heap* heap, void* previous, size_t oldSize, size_t newSize);
+// Fails the way an allocation would if `bytes` more would exceed the limit.
+// Parallel arrays check their combined growth first, so that either all of
+// them grow or none do.
+void reserveHeap(Heap* heap, size_t bytes);
+// Frees one object that is not on vm->objects; see takeNewestObject().
+void freeObject(VM* vm, Obj* object);
+void freeObjects(VM* vm);
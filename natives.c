@@ -0,0 +1,31 @@
+#include <math.h>
+
+#include "natives.h"
+
+void defineNatives(VM* vm)
+{
+    defineNumberNative1(vm, "abs", fabs);
+    defineNumberNative1(vm, "sqrt", sqrt);
+    defineNumberNative1(vm, "cbrt", cbrt);
+    defineNumberNative1(vm, "floor", floor);
+    defineNumberNative1(vm, "ceil", ceil);
+    defineNumberNative1(vm, "round", round);
+    defineNumberNative1(vm, "trunc", trunc);
+    defineNumberNative1(vm, "exp", exp);
+    defineNumberNative1(vm, "log", log);
+    defineNumberNative1(vm, "log2", log2);
+    defineNumberNative1(vm, "log10", log10);
+    defineNumberNative1(vm, "sin", sin);
+    defineNumberNative1(vm, "cos", cos);
+    defineNumberNative1(vm, "tan", tan);
+    defineNumberNative1(vm, "asin", asin);
+    defineNumberNative1(vm, "acos", acos);
+    defineNumberNative1(vm, "atan", atan);
+
+    defineNumberNative2(vm, "pow", pow);
+    defineNumberNative2(vm, "atan2", atan2);
+    defineNumberNative2(vm, "hypot", hypot);
+    defineNumberNative2(vm, "fmod", fmod);
+    defineNumberNative2(vm, "min", fmin);
+    defineNumberNative2(vm, "max", fmax);
+}
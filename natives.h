@@ -0,0 +1,6 @@
+#pragma once
+
+#include "vm.h"
+
+// Installs the builtin functions every VM starts with.
+void defineNatives(VM* vm);
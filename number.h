@@ -0,0 +1,25 @@
+#pragma once
+
+#include "common.h"
+
+// Large enough for the longest output of formatNumber, e.g.
+// "-2.2250738585072014e-308".
+#define NUMBER_BUFFER_SIZE 32
+
+// Writes a decimal string that reads back as exactly the same double. It is
+// usually the shortest such string, but not always: for roughly 0.2% of
+// doubles it has a digit more than needed. Returns the number of characters
+// written; no terminator is added.
+int formatNumber(double value, char* buffer);
+
+// Writes an integer in decimal and returns the number of characters written.
+int formatInteger(int64_t value, char* buffer);
+
+// Parses a literal of decimal digits. Returns false if it does not fit in an
+// int64_t.
+bool parseInteger(const char* start, int length, int64_t* value);
+
+// Parses a number literal as produced by the scanner (digits with an optional
+// fraction). The input does not need to be NUL-terminated and parsing does
+// not depend on the current locale.
+double parseNumber(const char* start, int length);
@@ -4,6 +4,8 @@
 #include "value.h"
 #include "vm.h"
 
+#include <limits.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,36 +15,188 @@
 
 static Obj* allocateObject(VM* vm, size_t size, ObjType type)
 {
-    Obj* object = (Obj*)reallocate(NULL, 0, size);
-    object->type = type;
-    object->next = vm->objects;
+    Obj* object = (Obj*)reallocate(&vm->heap, NULL, 0, size);
+    object->header = objHeader(type, 0, vm->objects);
     vm->objects = object;
     return object;
 }
 
-static ObjString* allocateString(VM* vm, char* chars, int length)
+ObjNative* newNative(VM* vm, const char* name, int arity)
+{
+    ObjNative* native = ALLOCATE_OBJ(vm, ObjNative, OBJ_NATIVE);
+    native->name = name;
+    native->arity = arity;
+    native->function = NULL;
+    native->number1 = NULL;
+    native->number2 = NULL;
+    return native;
+}
+
+// The object is linked into vm->objects before its characters are allocated,
+// so if that allocation fails the heap holds nothing that freeObjects() cannot
+// find.
+static ObjString* allocateString(VM* vm, int length)
 {
     ObjString* obj = ALLOCATE_OBJ(vm, ObjString, OBJ_STRING);
-    obj->chars = chars;
+    obj->chars = NULL;
     obj->length = length;
+    obj->chars = ALLOCATE(&vm->heap, char, length + 1);
     return obj;
 }
 
 ObjString* copyString(VM* vm, const char* chars, int length)
 {
-    return allocateString(vm, strndup(chars, length), length);
+    ObjString* string = allocateString(vm, length);
+    memcpy(string->chars, chars, length);
+    string->chars[length] = '\0';
+    return string;
+}
+
+Value stringValue(VM* vm, const char* chars, int length)
+{
+    if (fitsShortString(chars, length)) {
+        return shortStringValue(chars, length);
+    }
+    return OBJ_VAL(copyString(vm, chars, length));
+}
+
+// The characters of scratch strings. A string made by appending to, or
+// prepending to, another scratch string shares that string's buffer when
+// the buffer has room on that side, so a buffer holds several strings that
+// overlap. Bytes between `start` and `end` belong to some string and never
+// change, and a string can only be extended in place if it reaches `start`
+// or `end`. That keeps chains like s + s + s + ... and s + (s + (s + ...))
+// linear instead of copying the whole of the longer side every time.
+typedef struct {
+    int start;
+    int end;
+    int capacity;
+    char chars[];
+} ScratchChars;
+
+typedef struct {
+    ObjString string;
+    ScratchChars* buffer;
+} ScratchString;
+
+static ScratchChars* scratchBufferOf(Value value)
+{
+    if (!IS_OBJ(value) || !hasObjFlag(AS_OBJ(value), OBJ_SCRATCH)) {
+        return NULL;
+    }
+    return ((ScratchString*)AS_OBJ(value))->buffer;
+}
+
+bool concatenate(VM* vm, Value a, Value b, Value* result)
+{
+    int aLength, bLength;
+    const char* aChars = stringChars(&a, &aLength);
+    const char* bChars = stringChars(&b, &bLength);
+    if ((int64_t)aLength + bLength > INT_MAX) {
+        return false;
+    }
+    int length = aLength + bLength;
+
+    if (length <= SHORT_STRING_MAX) {
+        char chars[SHORT_STRING_MAX];
+        memcpy(chars, aChars, aLength);
+        memcpy(chars + aLength, bChars, bLength);
+        if (fitsShortString(chars, length)) {
+            *result = shortStringValue(chars, length);
+            return true;
+        }
+    }
+
+    // Most results are operands of the next operation and dead right after,
+    // so they go in the scratch region, characters and all, and are never
+    // freed one by one. Scratch characters are not NUL-terminated.
+    ScratchString* scratch = regionAllocate(&vm->scratch, sizeof(ScratchString));
+    ObjString* string = &scratch->string;
+    string->obj.header = objHeader(OBJ_STRING, OBJ_SCRATCH, NULL);
+    string->length = length;
+
+    ScratchChars* left = scratchBufferOf(a);
+    if (left != NULL && aChars + aLength == left->chars + left->end
+        && left->capacity - left->end >= bLength) {
+        memcpy(left->chars + left->end, bChars, bLength);
+        left->end += bLength;
+        string->chars = (char*)aChars;
+        scratch->buffer = left;
+        *result = OBJ_VAL(string);
+        return true;
+    }
+    ScratchChars* right = scratchBufferOf(b);
+    if (right != NULL && bChars == right->chars + right->start && right->start >= aLength) {
+        right->start -= aLength;
+        memcpy(right->chars + right->start, aChars, aLength);
+        string->chars = right->chars + right->start;
+        scratch->buffer = right;
+        *result = OBJ_VAL(string);
+        return true;
+    }
+
+    // Leave room to grow on a side that has been growing.
+    int room = length <= INT_MAX / 3 ? length : 0;
+    int before = right != NULL ? room : 0;
+    int after = left != NULL ? room : 0;
+    ScratchChars* buffer = regionAllocate(&vm->scratch, sizeof(ScratchChars) + before + length + after);
+    buffer->start = before;
+    buffer->end = before + length;
+    buffer->capacity = before + length + after;
+    memcpy(buffer->chars + before, aChars, aLength);
+    memcpy(buffer->chars + before + aLength, bChars, bLength);
+    string->chars = buffer->chars + before;
+    scratch->buffer = buffer;
+    *result = OBJ_VAL(string);
+    return true;
+}
+
+Value keepValue(VM* vm, Value value)
+{
+    if (!IS_OBJ(value) || !hasObjFlag(AS_OBJ(value), OBJ_SCRATCH)) {
+        return value;
+    }
+    ObjString* string = AS_STRING(value);
+    return OBJ_VAL(copyString(vm, string->chars, string->length));
 }
 
-ObjString* takeString(VM* vm, char* chars, int length)
+Obj* takeNewestObject(VM* vm)
 {
-    return allocateString(vm, chars, length);
+    Obj* object = vm->objects;
+    vm->objects = objNext(object);
+    return object;
+}
+
+void adoptObject(VM* vm, Obj* object)
+{
+    object->header = (object->header & ~OBJ_NEXT_MASK) | ((uint64_t)(uintptr_t)vm->objects & OBJ_NEXT_MASK);
+    vm->objects = object;
 }
 
 void printObject(Value value)
 {
     switch (OBJ_TYPE(value)) {
+    case OBJ_NATIVE:
+        printf("<native %s>", AS_NATIVE(value)->name);
+        break;
+    case OBJ_STRING:
+        printf("%.*s", AS_STRING(value)->length, AS_CSTRING(value));
+        break;
+    default:
+        break;
+    }
+}
+
+void writeObject(Output* out, Value value)
+{
+    switch (OBJ_TYPE(value)) {
+    case OBJ_NATIVE:
+        writeOutput(out, "<native ", 8);
+        writeOutput(out, AS_NATIVE(value)->name, strlen(AS_NATIVE(value)->name));
+        writeOutput(out, ">", 1);
+        break;
     case OBJ_STRING:
-        printf("%s", AS_CSTRING(value));
+        writeOutput(out, AS_CSTRING(value), AS_STRING(value)->length);
         break;
     default:
         break;
@@ -1,39 +1,141 @@
 #ifndef clox_object_h
 #define clox_object_h
 
+#include <assert.h>
+#include <string.h>
+
 #include "common.h"
 #include "value.h"
 #include "vm.h"
 
-#define OBJ_TYPE(value) (AS_OBJ(value)->type)
+#define OBJ_TYPE(value) objType(AS_OBJ(value))
 
+#define IS_NATIVE(value) isObjType(value, OBJ_NATIVE)
 #define IS_STRING(value) isObjType(value, OBJ_STRING)
+// True for both inline and heap strings.
+#define IS_ANY_STRING(value) (IS_SHORT_STRING(value) || IS_STRING(value))
 
+#define AS_NATIVE(value) ((ObjNative*)AS_OBJ(value))
 #define AS_STRING(value) ((ObjString*)AS_OBJ(value))
 #define AS_CSTRING(value) (((ObjString*)AS_OBJ(value))->chars)
 
 typedef enum {
+    OBJ_NATIVE,
     OBJ_STRING,
 } ObjType;
 
+// Bits of Obj.header above the pointer to the next object. Pointers to
+// objects fit in the low 48 bits on every 64-bit target we run on, so the
+// type and the flags live in the top two bytes and the header is one word.
+//
+// That is an assumption about the platform, not a guarantee. With 5-level
+// paging (x86-64 LA57), Linux only hands out addresses above 2^47 to
+// mappings that ask for them, which malloc does not. On AArch64, top-byte
+// ignore lets pointers carry tags in bits 56-63, and with memory tagging
+// (MTE) enabled for the heap, malloc returns tagged pointers. Masking the
+// tag off would make every object access fault. objHeader() asserts that
+// the top 16 bits are clear, so such a platform fails on its first
+// allocation rather than later.
+#if UINTPTR_MAX > UINT64_MAX
+#error "Obj.header packs a pointer into 48 bits of a uint64_t"
+#endif
+#define OBJ_TYPE_SHIFT 56
+#define OBJ_FLAGS_SHIFT 48
+#define OBJ_NEXT_MASK ((UINT64_C(1) << OBJ_FLAGS_SHIFT) - 1)
+
+// In vm->scratch, not on vm->objects; see keepValue().
+#define OBJ_SCRATCH 0x01
+// Reserved for a collector to mark reachable objects with.
+#define OBJ_MARKED 0x02
+
+// Every object starts with this: its ObjType, its flags and the next object
+// on vm->objects, packed as described above.
 struct Obj {
-    ObjType type;
-    struct Obj* next;
+    uint64_t header;
 };
 
 struct ObjString {
     Obj obj;
     int length;
-    char* chars;
+    char* chars; // NUL-terminated unless the string is scratch
+};
+
+typedef Value (*NativeFn)(int argCount, Value* args);
+typedef double (*NativeNumberFn1)(double);
+typedef double (*NativeNumberFn2)(double, double);
+
+// A function implemented in C. Natives either take Values (function) or are
+// numeric-only and called directly with doubles (number1/number2, matching
+// the arity), which skips boxing for libm-style routines.
+struct ObjNative {
+    Obj obj;
+    const char* name;
+    int arity;
+    NativeFn function;
+    NativeNumberFn1 number1;
+    NativeNumberFn2 number2;
 };
 
+ObjNative* newNative(VM* vm, const char* name, int arity);
 ObjString* copyString(VM* vm, const char* chars, int length);
-ObjString* takeString(VM* vm, char* chars, int length);
+Value stringValue(VM* vm, const char* chars, int length);
+// Joins two strings of either representation into `result`, or returns false
+// if the result would be longer than INT_MAX. The result is scratch: it
+// lives until the evaluation ends.
+bool concatenate(VM* vm, Value a, Value b, Value* result);
+// Returns `value`, or a copy of it on the heap if it is scratch. Anything
+// stored where it outlives the evaluation has to go through this.
+Value keepValue(VM* vm, Value value);
+// Takes the newest object off vm->objects. The caller owns it from then on
+// and either frees it with freeObject() or hands it back with adoptObject().
+Obj* takeNewestObject(VM* vm);
+void adoptObject(VM* vm, Obj* object);
 void printObject(Value value);
+void writeObject(Output* out, Value value);
+
+static inline uint64_t objHeader(ObjType type, int flags, Obj* next)
+{
+    assert(((uint64_t)(uintptr_t)next >> OBJ_FLAGS_SHIFT) == 0);
+    return (uint64_t)type << OBJ_TYPE_SHIFT | (uint64_t)flags << OBJ_FLAGS_SHIFT
+        | ((uint64_t)(uintptr_t)next & OBJ_NEXT_MASK);
+}
+
+static inline ObjType objType(const Obj* object)
+{
+    return (ObjType)(object->header >> OBJ_TYPE_SHIFT);
+}
+
+static inline bool hasObjFlag(const Obj* object, int flag)
+{
+    return (object->header >> OBJ_FLAGS_SHIFT & flag) != 0;
+}
+
+static inline void setObjFlag(Obj* object, int flag, bool set)
+{
+    uint64_t bit = (uint64_t)flag << OBJ_FLAGS_SHIFT;
+    object->header = set ? object->header | bit : object->header & ~bit;
+}
+
+static inline Obj* objNext(const Obj* object)
+{
+    return (Obj*)(uintptr_t)(object->header & OBJ_NEXT_MASK);
+}
 
 static inline bool isObjType(Value value, ObjType type)
 {
-    return IS_OBJ(value) && AS_OBJ(value)->type == type;
+    return IS_OBJ(value) && objType(AS_OBJ(value)) == type;
+}
+
+// Returns the characters of an inline or heap string. The pointer refers into
+// *value for inline strings, so it is only valid as long as *value is.
+static inline const char* stringChars(const Value* value, int* length)
+{
+    if (IS_SHORT_STRING(*value)) {
+        *length = (int)strlen(value->as.shortString);
+        return value->as.shortString;
+    }
+    *length = AS_STRING(*value)->length;
+    return AS_STRING(*value)->chars;
 }
 
 #endif
\ No newline at end of file
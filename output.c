@@ -0,0 +1,133 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "memory.h"
+#include "output.h"
+
+void initOutput(Output* out, Heap* heap, int fd)
+{
+    out->heap = heap;
+    out->kind = OUTPUT_FD;
+    out->fd = fd;
+    out->callback = NULL;
+    out->userData = NULL;
+    out->memory = NULL;
+    out->memoryLength = 0;
+    out->memoryCapacity = 0;
+    out->length = 0;
+}
+
+void freeOutput(Output* out)
+{
+    flushOutput(out);
+    FREE_ARRAY(out->heap, char, out->memory, out->memoryCapacity);
+    initOutput(out, out->heap, out->fd);
+}
+
+void outputToFd(Output* out, int fd)
+{
+    flushOutput(out);
+    out->kind = OUTPUT_FD;
+    out->fd = fd;
+}
+
+void outputToMemory(Output* out)
+{
+    flushOutput(out);
+    out->kind = OUTPUT_MEMORY;
+    out->memoryLength = 0;
+}
+
+void outputToCallback(Output* out, OutputCallback callback, void* userData)
+{
+    flushOutput(out);
+    out->kind = OUTPUT_CALLBACK;
+    out->callback = callback;
+    out->userData = userData;
+}
+
+static void writeFd(int fd, const char* bytes, size_t length)
+{
+    // Anything the host already printed through stdio has to go out first.
+    if (fd == STDOUT_FILENO) {
+        fflush(stdout);
+    }
+
+    while (length > 0) {
+        ssize_t written = write(fd, bytes, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        bytes += written;
+        length -= (size_t)written;
+    }
+}
+
+static void appendMemory(Output* out, const char* bytes, size_t length)
+{
+    if (out->memoryCapacity < out->memoryLength + length) {
+        size_t oldCapacity = out->memoryCapacity;
+        size_t capacity = GROW_CAPACITY(oldCapacity);
+        while (capacity < out->memoryLength + length) {
+            capacity *= 2;
+        }
+        out->memory = GROW_ARRAY(out->heap, out->memory, char, oldCapacity, capacity);
+        out->memoryCapacity = capacity;
+    }
+    memcpy(out->memory + out->memoryLength, bytes, length);
+    out->memoryLength += length;
+}
+
+static void sink(Output* out, const char* bytes, size_t length)
+{
+    switch (out->kind) {
+    case OUTPUT_FD:
+        writeFd(out->fd, bytes, length);
+        break;
+    case OUTPUT_MEMORY:
+        appendMemory(out, bytes, length);
+        break;
+    case OUTPUT_CALLBACK:
+        out->callback(out->userData, bytes, length);
+        break;
+    }
+}
+
+void flushOutput(Output* out)
+{
+    if (out->length == 0) {
+        return;
+    }
+    sink(out, out->buffer, out->length);
+    out->length = 0;
+}
+
+char* reserveOutput(Output* out, size_t length)
+{
+    if (OUTPUT_BUFFER_SIZE - out->length < length) {
+        flushOutput(out);
+    }
+    return out->buffer + out->length;
+}
+
+void writeOutput(Output* out, const char* bytes, size_t length)
+{
+    if (OUTPUT_BUFFER_SIZE - out->length >= length) {
+        memcpy(out->buffer + out->length, bytes, length);
+        out->length += length;
+        return;
+    }
+
+    flushOutput(out);
+    if (length >= OUTPUT_BUFFER_SIZE) {
+        sink(out, bytes, length);
+        return;
+    }
+    memcpy(out->buffer, bytes, length);
+    out->length = length;
+}
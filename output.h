@@ -0,0 +1,48 @@
+#pragma once
+
+#include "allocator.h"
+#include "common.h"
+
+#define OUTPUT_BUFFER_SIZE 8192
+
+typedef enum {
+    OUTPUT_FD,
+    OUTPUT_MEMORY,
+    OUTPUT_CALLBACK
+} OutputKind;
+
+typedef void (*OutputCallback)(void* userData, const char* bytes, size_t length);
+
+// A buffered sink for program output. Each VM owns one, so writes never take
+// a lock; the buffer is handed to the sink only when it fills up or when the
+// host flushes it.
+typedef struct {
+    Heap* heap; // for the OUTPUT_MEMORY buffer
+    OutputKind kind;
+    int fd;
+    OutputCallback callback;
+    void* userData;
+    // Everything flushed so far, for OUTPUT_MEMORY.
+    char* memory;
+    size_t memoryLength;
+    size_t memoryCapacity;
+    size_t length;
+    char buffer[OUTPUT_BUFFER_SIZE];
+} Output;
+
+void initOutput(Output* out, Heap* heap, int fd);
+void freeOutput(Output* out);
+void outputToFd(Output* out, int fd);
+void outputToMemory(Output* out);
+void outputToCallback(Output* out, OutputCallback callback, void* userData);
+void writeOutput(Output* out, const char* bytes, size_t length);
+void flushOutput(Output* out);
+
+// Reserves space for at least `length` bytes at the end of the buffer. The
+// caller fills it in and then calls commitOutput with the count written.
+char* reserveOutput(Output* out, size_t length);
+
+static inline void commitOutput(Output* out, size_t length)
+{
+    out->length += length;
+}
@@ -0,0 +1,144 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+#include "perf.h"
+
+static const char* counterNames[PERF_COUNTER_COUNT] = {
+    [PERF_INSTRUCTIONS] = "instructions",
+    [PERF_CYCLES] = "cycles",
+    [PERF_BRANCH_MISSES] = "branch-misses",
+    [PERF_L1D_MISSES] = "L1d-misses",
+    [PERF_LLC_MISSES] = "LLC-misses",
+};
+
+static const char* phaseNames[PERF_PHASE_COUNT] = {
+    [PERF_PHASE_SCAN] = "scan",
+    [PERF_PHASE_COMPILE] = "compile",
+    [PERF_PHASE_RUN] = "run",
+};
+
+#ifdef __linux__
+static int openCounter(uint32_t type, uint64_t config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t cacheMissConfig(uint64_t cache)
+{
+    return cache
+        | ((uint64_t)PERF_COUNT_HW_CACHE_OP_READ << 8)
+        | ((uint64_t)PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+#endif
+
+bool initPerfCounters(PerfCounters* perf)
+{
+    memset(perf, 0, sizeof(*perf));
+    bool any = false;
+
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        perf->fds[i] = -1;
+#ifdef __linux__
+        switch ((PerfCounter)i) {
+        case PERF_INSTRUCTIONS:
+            perf->fds[i] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+            break;
+        case PERF_CYCLES:
+            perf->fds[i] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+            break;
+        case PERF_BRANCH_MISSES:
+            perf->fds[i] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+            break;
+        case PERF_L1D_MISSES:
+            perf->fds[i] = openCounter(PERF_TYPE_HW_CACHE, cacheMissConfig(PERF_COUNT_HW_CACHE_L1D));
+            break;
+        case PERF_LLC_MISSES:
+            perf->fds[i] = openCounter(PERF_TYPE_HW_CACHE, cacheMissConfig(PERF_COUNT_HW_CACHE_LL));
+            break;
+        default:
+            break;
+        }
+        perf->openErrors[i] = perf->fds[i] < 0 ? errno : 0;
+#else
+        perf->openErrors[i] = ENOSYS;
+#endif
+        any |= perf->fds[i] >= 0;
+    }
+    return any;
+}
+
+void freePerfCounters(PerfCounters* perf)
+{
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (perf->fds[i] >= 0) {
+            close(perf->fds[i]);
+            perf->fds[i] = -1;
+        }
+    }
+}
+
+static uint64_t readCounter(int fd)
+{
+    uint64_t value = 0;
+    if (read(fd, &value, sizeof(value)) != sizeof(value)) {
+        return 0;
+    }
+    return value;
+}
+
+void beginPerfPhase(PerfCounters* perf)
+{
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (perf->fds[i] >= 0) {
+            perf->start[i] = readCounter(perf->fds[i]);
+        }
+    }
+}
+
+void endPerfPhase(PerfCounters* perf, PerfPhase phase)
+{
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (perf->fds[i] >= 0) {
+            perf->totals[phase][i] += readCounter(perf->fds[i]) - perf->start[i];
+        }
+    }
+    perf->runs[phase]++;
+}
+
+void reportPerfCounters(PerfCounters* perf, FILE* file)
+{
+    fprintf(file, "%-16s", "counter");
+    for (int phase = 0; phase < PERF_PHASE_COUNT; phase++) {
+        fprintf(file, " %16s", phaseNames[phase]);
+    }
+    fprintf(file, "\n");
+
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        fprintf(file, "%-16s", counterNames[i]);
+        if (perf->fds[i] < 0) {
+            fprintf(file, " unavailable (%s)\n", strerror(perf->openErrors[i]));
+            continue;
+        }
+        for (int phase = 0; phase < PERF_PHASE_COUNT; phase++) {
+            fprintf(file, " %16llu", (unsigned long long)perf->totals[phase][i]);
+        }
+        fprintf(file, "\n");
+    }
+    fprintf(file, "(scan is a separate pass over the source; compile includes its own scanning)\n");
+}
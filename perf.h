@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "common.h"
+
+typedef enum {
+    PERF_INSTRUCTIONS,
+    PERF_CYCLES,
+    PERF_BRANCH_MISSES,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_COUNTER_COUNT
+} PerfCounter;
+
+typedef enum {
+    PERF_PHASE_SCAN,
+    PERF_PHASE_COMPILE,
+    PERF_PHASE_RUN,
+    PERF_PHASE_COUNT
+} PerfPhase;
+
+// Hardware counters sampled around each interpreter phase. Counters that
+// the kernel refuses to open (no PMU, perf_event_paranoid, seccomp in a
+// container, non-Linux hosts) are simply left out of the report.
+typedef struct {
+    int fds[PERF_COUNTER_COUNT];
+    int openErrors[PERF_COUNTER_COUNT]; // errno from opening each counter
+    uint64_t start[PERF_COUNTER_COUNT];
+    uint64_t totals[PERF_PHASE_COUNT][PERF_COUNTER_COUNT];
+    uint64_t runs[PERF_PHASE_COUNT];
+} PerfCounters;
+
+// Returns false if no counter at all could be opened.
+bool initPerfCounters(PerfCounters* perf);
+void freePerfCounters(PerfCounters* perf);
+void beginPerfPhase(PerfCounters* perf);
+void endPerfPhase(PerfCounters* perf, PerfPhase phase);
+void reportPerfCounters(PerfCounters* perf, FILE* file);
@@ -0,0 +1,243 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "debug.h"
+#include "profile.h"
+#include "regchunk.h"
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+typedef struct {
+    int line;
+    uint8_t opcode;
+    bool registers;
+    uint32_t count; // 0 for an empty bucket
+} ProfileBucket;
+
+// Everything the handler touches is here, allocated up front: it runs in
+// the middle of whatever the thread was doing, so it cannot allocate, lock
+// or call anything that might.
+static ProfileSite* volatile sampled; // NULL while stopped
+static ProfileBucket buckets[PROFILE_BUCKET_COUNT];
+static uint64_t idle; // taken while no chunk was running
+static uint64_t dropped; // taken once every bucket was in use
+static struct sigaction previous;
+#ifdef SIGEV_THREAD_ID
+static timer_t timer;
+#endif
+
+void initSite(ProfileSite* site)
+{
+    site->code = NULL;
+    site->lines = NULL;
+    site->count = 0;
+    site->registers = false;
+    site->at = 0;
+}
+
+// `code` goes last, so a sample taken part way through sees either no chunk
+// or all of this one.
+void enterSite(ProfileSite* site, const void* code, const int* lines, int count, bool registers)
+{
+    site->code = NULL;
+    site->lines = lines;
+    site->count = count;
+    site->registers = registers;
+    site->at = (uintptr_t)code;
+    site->code = code;
+}
+
+void leaveSite(ProfileSite* site)
+{
+    site->code = NULL;
+}
+
+static void countSample(int line, uint8_t opcode, bool registers)
+{
+    uint32_t hash = ((uint32_t)line * 2654435761u) ^ ((uint32_t)opcode << 1 | registers);
+    for (int probe = 0; probe < PROFILE_BUCKET_COUNT; probe++) {
+        ProfileBucket* bucket = &buckets[(hash + probe) & (PROFILE_BUCKET_COUNT - 1)];
+        if (bucket->count == 0) {
+            *bucket = (ProfileBucket) { .line = line, .opcode = opcode, .registers = registers };
+        } else if (bucket->line != line || bucket->opcode != opcode || bucket->registers != registers) {
+            continue;
+        }
+        bucket->count++;
+        return;
+    }
+    dropped++;
+}
+
+// SIGPROF is blocked while this runs, so it never interrupts itself.
+static void takeSample(int signal)
+{
+    (void)signal;
+    ProfileSite* site = sampled;
+    if (site == NULL) {
+        return;
+    }
+
+    const void* code = site->code;
+    if (code == NULL) {
+        idle++;
+        return;
+    }
+    bool registers = site->registers;
+    uintptr_t offset = site->at - (uintptr_t)code;
+    uintptr_t index = registers ? offset / sizeof(RegInstruction) : offset;
+    if (site->at < (uintptr_t)code || index >= (uintptr_t)site->count) {
+        idle++;
+        return;
+    }
+    uint8_t opcode = registers ? ((const RegInstruction*)code)[index].op : ((const uint8_t*)code)[index];
+    countSample(site->lines[index], opcode, registers);
+}
+
+// Only CPU time the thread spends counts, so a VM waiting on input is not
+// sampled. Where there is no per-thread timer, the process-wide one stands
+// in, and other threads' time is then sampled too, as not interpreting.
+static bool armTimer(int hz)
+{
+    long interval = 1000000000L / hz;
+#ifdef SIGEV_THREAD_ID
+    struct sigevent event;
+    memset(&event, 0, sizeof(event));
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = SIGPROF;
+    event.sigev_notify_thread_id = (pid_t)syscall(SYS_gettid);
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &timer) != 0) {
+        return false;
+    }
+    struct itimerspec spec = {
+        .it_interval = { .tv_sec = interval / 1000000000L, .tv_nsec = interval % 1000000000L },
+        .it_value = { .tv_sec = interval / 1000000000L, .tv_nsec = interval % 1000000000L },
+    };
+    if (timer_settime(timer, 0, &spec, NULL) != 0) {
+        int error = errno;
+        timer_delete(timer);
+        errno = error;
+        return false;
+    }
+    return true;
+#else
+    struct itimerval spec = {
+        .it_interval = { .tv_sec = interval / 1000000000L, .tv_usec = interval % 1000000000L / 1000 },
+        .it_value = { .tv_sec = interval / 1000000000L, .tv_usec = interval % 1000000000L / 1000 },
+    };
+    return setitimer(ITIMER_PROF, &spec, NULL) == 0;
+#endif
+}
+
+static void disarmTimer(void)
+{
+#ifdef SIGEV_THREAD_ID
+    timer_delete(timer);
+#else
+    struct itimerval off;
+    memset(&off, 0, sizeof(off));
+    setitimer(ITIMER_PROF, &off, NULL);
+#endif
+}
+
+bool startProfiler(ProfileSite* site, int hz)
+{
+    if (sampled != NULL || hz <= 0) {
+        errno = EINVAL;
+        return false;
+    }
+    memset(buckets, 0, sizeof(buckets));
+    idle = 0;
+    dropped = 0;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = takeSample;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    if (sigaction(SIGPROF, &action, &previous) != 0) {
+        return false;
+    }
+    sampled = site;
+    if (!armTimer(hz)) {
+        int error = errno;
+        sampled = NULL;
+        sigaction(SIGPROF, &previous, NULL);
+        errno = error;
+        return false;
+    }
+    return true;
+}
+
+void stopProfiler(void)
+{
+    if (sampled == NULL) {
+        return;
+    }
+    disarmTimer();
+    // A signal already pending finds `sampled` cleared and does nothing.
+    sampled = NULL;
+    sigaction(SIGPROF, &previous, NULL);
+}
+
+static int compareBuckets(const void* a, const void* b)
+{
+    const ProfileBucket* left = a;
+    const ProfileBucket* right = b;
+    if (left->line != right->line) {
+        return left->line < right->line ? -1 : 1;
+    }
+    if (left->registers != right->registers) {
+        return left->registers ? 1 : -1;
+    }
+    return (int)left->opcode - (int)right->opcode;
+}
+
+// Semicolons separate frames, so the root must not contain any.
+static void writeRoot(FILE* file, const char* root)
+{
+    for (const char* c = root; *c != '\0'; c++) {
+        fputc(*c == ';' ? '_' : *c, file);
+    }
+}
+
+void writeProfile(FILE* file, const char* root)
+{
+    ProfileBucket* sorted = malloc(sizeof(buckets));
+    int count = 0;
+    for (int i = 0; sorted != NULL && i < PROFILE_BUCKET_COUNT; i++) {
+        if (buckets[i].count > 0) {
+            sorted[count++] = buckets[i];
+        }
+    }
+    qsort(sorted, count, sizeof(ProfileBucket), compareBuckets);
+
+    for (int i = 0; i < count; i++) {
+        ProfileBucket* bucket = &sorted[i];
+        const char* name = bucket->registers ? regOpcodeName(bucket->opcode) : opcodeName(bucket->opcode);
+        writeRoot(file, root);
+        fprintf(file, ";line %d;%s%s %u\n", bucket->line, name != NULL ? name : "unknown",
+            bucket->registers ? " (registers)" : "", bucket->count);
+    }
+    if (idle > 0) {
+        writeRoot(file, root);
+        fprintf(file, ";(not interpreting) %llu\n", (unsigned long long)idle);
+    }
+    if (dropped > 0) {
+        writeRoot(file, root);
+        fprintf(file, ";(too many lines) %llu\n", (unsigned long long)dropped);
+    }
+    free(sorted);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "common.h"
+
+// Samples per second of CPU time asked for. Taking a sample costs a few
+// microseconds of signal delivery, so at this rate the profiler slows a run
+// by under 1%. It is prime so that sampling does not fall into step with
+// loops. CPU-time timers expire on the kernel's tick, so with CONFIG_HZ=250
+// a run gets at most 250 samples per second of CPU time.
+#define PROFILE_DEFAULT_HZ 997
+// Distinct (engine, line, opcode) triples kept; samples of any more are
+// only counted.
+#define PROFILE_BUCKET_COUNT 4096
+
+// Where a VM says what it is running, for the profiler's signal handler to
+// read. The engines store the address of the instruction they are about to
+// execute in `at` on every dispatch, whether or not a profiler is running;
+// `code` is NULL whenever neither engine is running, and is cleared before a
+// chunk can be freed. Only the thread running the VM writes the site and only
+// a handler interrupting that thread reads it, so volatile is all the
+// synchronization it needs.
+typedef struct {
+    const void* volatile code; // stack bytecode, or RegInstructions
+    const int* volatile lines; // by instruction index
+    volatile int count; // instructions in `code`
+    volatile bool registers; // `code` belongs to a register chunk
+    // An integer rather than a pointer: a store through a pointer type may
+    // alias the VM's other pointers, and the engines would reload those
+    // after every dispatch.
+    volatile uintptr_t at;
+} ProfileSite;
+
+void initSite(ProfileSite* site);
+// Points the site at a chunk that is about to run.
+void enterSite(ProfileSite* site, const void* code, const int* lines, int count, bool registers);
+void leaveSite(ProfileSite* site);
+
+// A statistical profiler: a CPU-time timer interrupts the calling thread
+// `hz` times a second with SIGPROF, and the handler counts the instruction
+// `site` points at by engine, source line and opcode. There is one profiler
+// per process. Returns false, with errno set, if the timer cannot be set up.
+bool startProfiler(ProfileSite* site, int hz);
+void stopProfiler(void);
+// Writes the samples as collapsed stacks, one `root;line N;OPCODE count`
+// line per triple, which is what flamegraph.pl and similar tools read. Each
+// line is the parent of its opcodes, so the graph totals samples by line and
+// splits every line by opcode. Samples taken while no chunk was running go
+// under `root;(not interpreting)`.
+void writeProfile(FILE* file, const char* root);
@@ -0,0 +1,266 @@
+#include <setjmp.h>
+
+#include "memory.h"
+#include "regchunk.h"
+
+void initRegChunk(RegChunk* chunk, Heap* heap)
+{
+    *chunk = (RegChunk) {
+        .heap = heap,
+        .count = 0,
+        .capacity = 0,
+        .code = NULL,
+        .lines = NULL,
+        .registerCount = 0,
+    };
+    initValueArray(&chunk->constants, heap);
+}
+
+void freeRegChunk(RegChunk* chunk)
+{
+    FREE_ARRAY(chunk->heap, RegInstruction, chunk->code, chunk->capacity);
+    FREE_ARRAY(chunk->heap, int, chunk->lines, chunk->capacity);
+    freeValueArray(&chunk->constants);
+    initRegChunk(chunk, chunk->heap);
+}
+
+static void writeRegChunk(RegChunk* chunk, RegInstruction instruction, int line)
+{
+    if (chunk->capacity < chunk->count + 1) {
+        int oldCapacity = chunk->capacity;
+        int capacity = GROW_CAPACITY(oldCapacity);
+        reserveHeap(chunk->heap, (capacity - oldCapacity) * (sizeof(RegInstruction) + sizeof(int)));
+        chunk->code = GROW_ARRAY(chunk->heap, chunk->code, RegInstruction, oldCapacity, capacity);
+        chunk->lines = GROW_ARRAY(chunk->heap, chunk->lines, int, oldCapacity, capacity);
+        chunk->capacity = capacity;
+    }
+    chunk->code[chunk->count] = instruction;
+    chunk->lines[chunk->count] = line;
+    chunk->count++;
+}
+
+// What each stack slot holds during translation: a constant that has not
+// been loaded into its register, or -1 once the register holds the value.
+typedef struct {
+    RegChunk* out;
+    int* pending;
+    int literals[3]; // constants made for nil, true and false, or -1
+} Translator;
+
+static int literalConstant(Translator* translator, int which, Value value)
+{
+    if (translator->literals[which] < 0) {
+        writeValueArray(&translator->out->constants, value);
+        translator->literals[which] = translator->out->constants.count - 1;
+    }
+    return translator->literals[which];
+}
+
+// Encodes slot `slot` as operand b or c, folding a pending constant.
+static uint16_t operand(Translator* translator, int slot, uint8_t* flags, uint8_t constantFlag)
+{
+    if (translator->pending[slot] >= 0) {
+        *flags |= constantFlag;
+        return (uint16_t)translator->pending[slot];
+    }
+    return (uint16_t)slot;
+}
+
+static void materialize(Translator* translator, int slot, int line)
+{
+    if (translator->pending[slot] < 0) {
+        return;
+    }
+    writeRegChunk(translator->out, (RegInstruction) {
+        .op = REG_LOAD_CONSTANT,
+        .a = (uint16_t)slot,
+        .b = (uint16_t)translator->pending[slot],
+    }, line);
+    translator->pending[slot] = -1;
+}
+
+static RegOpCode binaryOpcode(OpCode opcode)
+{
+    switch (opcode) {
+    case OP_ADD:
+        return REG_ADD;
+    case OP_SUBTRACT:
+        return REG_SUBTRACT;
+    case OP_MULTIPLY:
+        return REG_MULTIPLY;
+    case OP_DIVIDE:
+        return REG_DIVIDE;
+    case OP_EQUAL:
+        return REG_EQUAL;
+    case OP_GREATER:
+        return REG_GREATER;
+    default:
+        return REG_LESS;
+    }
+}
+
+static bool translateCode(Translator* translator, Chunk* chunk)
+{
+    RegChunk* out = translator->out;
+    for (int i = 0; i < chunk->constants.count; i++) {
+        writeValueArray(&out->constants, chunk->constants.values[i]);
+    }
+
+    // The verifier guarantees straight-line code with a known depth at each
+    // instruction.
+    int depth = 0;
+    bool translated = true;
+    for (int offset = 0; offset < chunk->count && translated;) {
+        OpCode opcode = genericOpcode(chunk->code[offset]);
+        int line = chunk->lines[offset];
+        int top = depth - 1;
+        uint8_t flags = 0;
+
+        switch (opcode) {
+        case OP_CONSTANT:
+            translator->pending[depth] = chunk->code[offset + 1];
+            break;
+        case OP_NIL:
+            translator->pending[depth] = literalConstant(translator, 0, NIL_VAL);
+            break;
+        case OP_TRUE:
+            translator->pending[depth] = literalConstant(translator, 1, BOOL_VAL(true));
+            break;
+        case OP_FALSE:
+            translator->pending[depth] = literalConstant(translator, 2, BOOL_VAL(false));
+            break;
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS: {
+            uint16_t b = operand(translator, top - 1, &flags, REG_B_CONSTANT);
+            uint16_t c = operand(translator, top, &flags, REG_C_CONSTANT);
+            writeRegChunk(out, (RegInstruction) {
+                .op = binaryOpcode(opcode),
+                .flags = flags,
+                .a = (uint16_t)(top - 1),
+                .b = b,
+                .c = c,
+            }, line);
+            translator->pending[top - 1] = -1;
+            break;
+        }
+        case OP_NOT:
+        case OP_NEGATE: {
+            uint16_t b = operand(translator, top, &flags, REG_B_CONSTANT);
+            writeRegChunk(out, (RegInstruction) {
+                .op = opcode == OP_NOT ? REG_NOT : REG_NEGATE,
+                .flags = flags,
+                .a = (uint16_t)top,
+                .b = b,
+            }, line);
+            translator->pending[top] = -1;
+            break;
+        }
+        case OP_CALL: {
+            // The callee and its arguments have to sit in consecutive
+            // registers.
+            int argCount = chunk->code[offset + 1];
+            int callee = top - argCount;
+            for (int slot = callee; slot <= top; slot++) {
+                materialize(translator, slot, line);
+            }
+            writeRegChunk(out, (RegInstruction) {
+                .op = REG_CALL,
+                .a = (uint16_t)callee,
+                .b = (uint16_t)argCount,
+            }, line);
+            depth -= argCount;
+            break;
+        }
+        case OP_POP:
+            break;
+        case OP_GET_GLOBAL:
+            writeRegChunk(out, (RegInstruction) {
+                .op = REG_GET_GLOBAL,
+                .a = (uint16_t)depth,
+                .b = (uint16_t)(chunk->code[offset + 1] << 8 | chunk->code[offset + 2]),
+            }, line);
+            translator->pending[depth] = -1;
+            break;
+        case OP_SET_GLOBAL:
+        case OP_DEFINE_GLOBAL: {
+            // The value stays where it is, so a pending constant can still be
+            // folded into later uses of the slot.
+            uint16_t b = operand(translator, top, &flags, REG_B_CONSTANT);
+            writeRegChunk(out, (RegInstruction) {
+                .op = opcode == OP_SET_GLOBAL ? REG_SET_GLOBAL : REG_DEFINE_GLOBAL,
+                .flags = flags,
+                .a = (uint16_t)(chunk->code[offset + 1] << 8 | chunk->code[offset + 2]),
+                .b = b,
+            }, line);
+            break;
+        }
+        case OP_RETURN: {
+            uint16_t b = operand(translator, top, &flags, REG_B_CONSTANT);
+            writeRegChunk(out, (RegInstruction) {
+                .op = REG_RETURN,
+                .flags = flags,
+                .b = b,
+            }, line);
+            break;
+        }
+        default:
+            translated = false;
+            break;
+        }
+
+        const OpInfo* info = &opInfo[opcode];
+        depth += info->pushes - info->pops;
+        offset += 1 + info->operandBytes;
+    }
+    return translated;
+}
+
+// The pending table is scratch on systemHeap; free it, and the partial
+// translation, if an allocation from the chunk's heap fails part way. The
+// translator is reached through a pointer, so none of this function's
+// locals change between setjmp() and longjmp().
+static bool translateRecovering(Translator* translator, Chunk* chunk)
+{
+    jmp_buf* outer = chunk->heap->recover;
+    jmp_buf recover;
+    if (outer != NULL) {
+        if (setjmp(recover)) {
+            FREE_ARRAY(&systemHeap, int, translator->pending, chunk->maxStack + 1);
+            freeRegChunk(translator->out);
+            chunk->heap->recover = outer;
+            longjmp(*outer, 1);
+        }
+        chunk->heap->recover = &recover;
+    }
+
+    bool translated = translateCode(translator, chunk);
+    chunk->heap->recover = outer;
+    return translated;
+}
+
+bool translateChunk(Chunk* chunk, RegChunk* out)
+{
+    initRegChunk(out, chunk->heap);
+    if (chunk->maxStack > UINT16_MAX + 1 || chunk->constants.count + 3 > UINT16_MAX + 1) {
+        return false;
+    }
+    out->registerCount = chunk->maxStack;
+
+    Translator translator = (Translator) {
+        .out = out,
+        .pending = ALLOCATE(&systemHeap, int, chunk->maxStack + 1),
+        .literals = { -1, -1, -1 },
+    };
+
+    bool translated = translateRecovering(&translator, chunk);
+    FREE_ARRAY(&systemHeap, int, translator.pending, chunk->maxStack + 1);
+    if (!translated) {
+        freeRegChunk(out);
+    }
+    return translated;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "chunk.h"
+#include "common.h"
+#include "value.h"
+
+// Three-address register bytecode, translated from a verified stack chunk.
+// Stack slot i becomes register i, and constants are folded into the
+// instructions that use them instead of being pushed.
+typedef enum {
+    REG_LOAD_CONSTANT, // R(a) = K(b)
+    REG_ADD, // R(a) = RK(b) + RK(c)
+    REG_SUBTRACT,
+    REG_MULTIPLY,
+    REG_DIVIDE,
+    REG_EQUAL,
+    REG_GREATER,
+    REG_LESS,
+    REG_NOT, // R(a) = !RK(b)
+    REG_NEGATE, // R(a) = -RK(b)
+    REG_CALL, // R(a) = R(a)(R(a + 1) ... R(a + b))
+    REG_GET_GLOBAL, // R(a) = G(b)
+    REG_SET_GLOBAL, // G(a) = RK(b), once G(a) is defined
+    REG_DEFINE_GLOBAL, // G(a) = RK(b)
+    REG_RETURN, // print RK(b)
+    REG_OP_COUNT
+} RegOpCode;
+
+// Operand b or c names a constant rather than a register.
+#define REG_B_CONSTANT 1
+#define REG_C_CONSTANT 2
+
+typedef struct {
+    uint8_t op;
+    uint8_t flags;
+    uint16_t a;
+    uint16_t b;
+    uint16_t c;
+} RegInstruction;
+
+typedef struct RegChunk {
+    Heap* heap;
+    int count;
+    int capacity;
+    RegInstruction* code;
+    int* lines;
+    int registerCount;
+    ValueArray constants; // the stack chunk's constants, then nil/true/false
+} RegChunk;
+
+void initRegChunk(RegChunk* chunk, Heap* heap);
+void freeRegChunk(RegChunk* chunk);
+// Returns false, leaving `out` empty, for chunks the register engine cannot
+// run: more than UINT16_MAX registers, or an instruction it does not know.
+// `out` is left empty as well if an allocation fails part way.
+bool translateChunk(Chunk* chunk, RegChunk* out);
@@ -0,0 +1,104 @@
+#include "memory.h"
+#include "region.h"
+
+// Every allocation is rounded up to this, which suits doubles, pointers and
+// int64_t.
+#define REGION_ALIGNMENT 8
+
+struct RegionBlock {
+    RegionBlock* next;
+    size_t size; // bytes of data
+    size_t used; // only meaningful up to region->current
+    // The header is three words, so the data is aligned too.
+    char data[];
+};
+
+void initRegion(Region* region, Heap* heap)
+{
+    *region = (Region) {
+        .heap = heap,
+        .first = NULL,
+        .current = NULL,
+        .bytes = 0,
+    };
+}
+
+void freeRegion(Region* region)
+{
+    RegionBlock* block = region->first;
+    while (block != NULL) {
+        RegionBlock* next = block->next;
+        reallocate(region->heap, block, sizeof(RegionBlock) + block->size, 0);
+        block = next;
+    }
+    initRegion(region, region->heap);
+}
+
+static RegionBlock* appendBlock(Region* region, RegionBlock* last, size_t size)
+{
+    RegionBlock* block = reallocate(region->heap, NULL, 0, sizeof(RegionBlock) + size);
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    if (last == NULL) {
+        region->first = block;
+    } else {
+        last->next = block;
+    }
+    region->bytes += size;
+    return block;
+}
+
+// Moves on to the first empty block after the current one that fits `size`,
+// adding one at the end if none does.
+static RegionBlock* nextBlock(Region* region, size_t size)
+{
+    RegionBlock* block = region->current;
+    for (;;) {
+        RegionBlock* next = block == NULL ? region->first : block->next;
+        if (next == NULL) {
+            next = appendBlock(region, block, size > REGION_BLOCK_SIZE ? size : REGION_BLOCK_SIZE);
+        }
+        // Blocks past the current one still hold whatever they held before
+        // the last reset.
+        next->used = 0;
+        region->current = next;
+        if (next->size >= size) {
+            return next;
+        }
+        block = next;
+    }
+}
+
+void* regionAllocate(Region* region, size_t size)
+{
+    size = (size + REGION_ALIGNMENT - 1) & ~(size_t)(REGION_ALIGNMENT - 1);
+    RegionBlock* block = region->current;
+    if (block == NULL || block->size - block->used < size) {
+        block = nextBlock(region, size);
+    }
+    void* result = block->data + block->used;
+    block->used += size;
+    return result;
+}
+
+void resetRegion(Region* region)
+{
+    region->current = region->first;
+    if (region->first != NULL) {
+        region->first->used = 0;
+    }
+}
+
+void reserveRegion(Region* region, size_t bytes)
+{
+    if (region->bytes >= bytes) {
+        return;
+    }
+    RegionBlock* last = region->first;
+    while (last != NULL && last->next != NULL) {
+        last = last->next;
+    }
+    size_t size = bytes - region->bytes;
+    appendBlock(region, last, size > REGION_BLOCK_SIZE ? size : REGION_BLOCK_SIZE);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "allocator.h"
+#include "common.h"
+
+#define REGION_BLOCK_SIZE (64 << 10)
+
+typedef struct RegionBlock RegionBlock;
+
+// A bump allocator for memory that dies all at once. Allocation takes the
+// next bytes of the current block; resetting makes every block empty again
+// in O(1) without freeing anything, so once the blocks cover the largest
+// working set, allocating never reaches the heap.
+typedef struct {
+    Heap* heap;
+    RegionBlock* first;
+    RegionBlock* current; // blocks after this one are empty
+    size_t bytes; // total size of all blocks
+} Region;
+
+void initRegion(Region* region, Heap* heap);
+void freeRegion(Region* region);
+// Returns `size` bytes aligned for any Value or object.
+void* regionAllocate(Region* region, size_t size);
+// Releases everything allocated so far; the blocks are kept for reuse.
+void resetRegion(Region* region);
+// Adds a block so that at least `bytes` can be allocated after a reset
+// without growing the region.
+void reserveRegion(Region* region, size_t bytes);
@@ -84,12 +84,13 @@ void skipWhiteSpace(Scanner* scanner)
             advance(scanner);
             break;
         case '/':
-            if (peekNext(scanner) == '/') {
-                while (peek(scanner) != '\n' && !isAtEnd(scanner)) {
-                    advance(scanner);
-                }
+            if (peekNext(scanner) != '/') {
+                return;
             }
-            return;
+            while (peek(scanner) != '\n' && !isAtEnd(scanner)) {
+                advance(scanner);
+            }
+            break;
         default:
             return;
         }
@@ -98,11 +99,8 @@ void skipWhiteSpace(Scanner* scanner)
 
 static TokenType checkKeyword(Scanner* scanner, int start, int length, char* rest, TokenType type)
 {
-    char keyword[length];
-    strncpy(&keyword[0], scanner->start + start, length);
-
-    int equal = strncmp(keyword, rest, length) == 0;
-    if (scanner->current - scanner->start == start + length && equal) {
+    if (scanner->current - scanner->start == start + length
+        && memcmp(scanner->start + start, rest, length) == 0) {
         return type;
     }
     return TOKEN_IDENTIFIER;
@@ -0,0 +1,341 @@
+#include <string.h>
+
+#include "memory.h"
+#include "object.h"
+#include "serialize.h"
+
+#define CHUNK_MAGIC "CLXC"
+#define CHUNK_VERSION 2
+
+typedef enum {
+    CONSTANT_NIL,
+    CONSTANT_BOOL,
+    CONSTANT_NUMBER,
+    CONSTANT_INT,
+    CONSTANT_STRING,
+    CONSTANT_NATIVE,
+} ConstantTag;
+
+typedef struct {
+    Heap* heap;
+    uint8_t* bytes;
+    size_t length;
+    size_t capacity;
+} Writer;
+
+static void writeBytes(Writer* writer, const void* bytes, size_t length)
+{
+    if (writer->capacity < writer->length + length) {
+        size_t oldCapacity = writer->capacity;
+        while (writer->capacity < writer->length + length) {
+            writer->capacity = GROW_CAPACITY(writer->capacity);
+        }
+        writer->bytes = GROW_ARRAY(writer->heap, writer->bytes, uint8_t, oldCapacity, writer->capacity);
+    }
+    memcpy(writer->bytes + writer->length, bytes, length);
+    writer->length += length;
+}
+
+static void writeU8(Writer* writer, uint8_t value)
+{
+    writeBytes(writer, &value, 1);
+}
+
+static void writeU32(Writer* writer, uint32_t value)
+{
+    uint8_t bytes[4];
+    for (int i = 0; i < 4; i++) {
+        bytes[i] = (uint8_t)(value >> (8 * i));
+    }
+    writeBytes(writer, bytes, 4);
+}
+
+static void writeU64(Writer* writer, uint64_t value)
+{
+    uint8_t bytes[8];
+    for (int i = 0; i < 8; i++) {
+        bytes[i] = (uint8_t)(value >> (8 * i));
+    }
+    writeBytes(writer, bytes, 8);
+}
+
+static void writeName(Writer* writer, const char* chars, int length)
+{
+    writeU32(writer, (uint32_t)length);
+    writeBytes(writer, chars, length);
+}
+
+static void writeConstant(Writer* writer, Value value)
+{
+    if (IS_ANY_STRING(value)) {
+        int length;
+        const char* chars = stringChars(&value, &length);
+        writeU8(writer, CONSTANT_STRING);
+        writeName(writer, chars, length);
+        return;
+    }
+
+    switch (value.type) {
+    case VAL_NIL:
+        writeU8(writer, CONSTANT_NIL);
+        break;
+    case VAL_BOOL:
+        writeU8(writer, CONSTANT_BOOL);
+        writeU8(writer, AS_BOOL(value));
+        break;
+    case VAL_NUMBER: {
+        uint64_t bits;
+        double number = AS_NUMBER(value);
+        memcpy(&bits, &number, sizeof(bits));
+        writeU8(writer, CONSTANT_NUMBER);
+        writeU64(writer, bits);
+        break;
+    }
+    case VAL_INT:
+        writeU8(writer, CONSTANT_INT);
+        writeU64(writer, (uint64_t)AS_INT(value));
+        break;
+    default: {
+        ObjNative* native = AS_NATIVE(value);
+        writeU8(writer, CONSTANT_NATIVE);
+        writeName(writer, native->name, (int)strlen(native->name));
+        break;
+    }
+    }
+}
+
+static bool isGlobalInstruction(uint8_t instruction)
+{
+    return instruction == OP_DEFINE_GLOBAL || instruction == OP_GET_GLOBAL
+        || instruction == OP_SET_GLOBAL;
+}
+
+// Global slots only mean something in the VM that assigned them, so an image
+// numbers the globals it uses from zero and lists their names; loading
+// declares the names and maps the numbers back to slots.
+static void writeGlobals(Writer* writer, VM* vm, Chunk* chunk, size_t codeStart)
+{
+    int* imageIndex = ALLOCATE(&systemHeap, int, vm->globals.count + 1);
+    for (int i = 0; i < vm->globals.count; i++) {
+        imageIndex[i] = -1;
+    }
+
+    int* slots = ALLOCATE(&systemHeap, int, vm->globals.count + 1);
+    int count = 0;
+    for (int offset = 0; offset < chunk->count; offset += 1 + opInfo[chunk->code[offset]].operandBytes) {
+        if (!isGlobalInstruction(chunk->code[offset])) {
+            continue;
+        }
+        int slot = chunk->code[offset + 1] << 8 | chunk->code[offset + 2];
+        if (imageIndex[slot] < 0) {
+            imageIndex[slot] = count;
+            slots[count++] = slot;
+        }
+        uint8_t* operand = writer->bytes + codeStart + offset + 1;
+        operand[0] = (uint8_t)(imageIndex[slot] >> 8);
+        operand[1] = (uint8_t)imageIndex[slot];
+    }
+
+    writeU32(writer, (uint32_t)count);
+    for (int i = 0; i < count; i++) {
+        GlobalName* name = &vm->globals.names[slots[i]];
+        writeName(writer, name->chars, name->length);
+    }
+    FREE_ARRAY(&systemHeap, int, slots, vm->globals.count + 1);
+    FREE_ARRAY(&systemHeap, int, imageIndex, vm->globals.count + 1);
+}
+
+uint8_t* serializeChunk(VM* vm, Chunk* chunk, size_t* length)
+{
+    Writer writer = (Writer) { .heap = chunk->heap, .bytes = NULL, .length = 0, .capacity = 0 };
+    writeBytes(&writer, CHUNK_MAGIC, 4);
+    writeU32(&writer, CHUNK_VERSION);
+    writeU32(&writer, (uint32_t)chunk->count);
+    writeU32(&writer, (uint32_t)chunk->maxStack);
+    size_t codeStart = writer.length;
+    writeBytes(&writer, chunk->code, chunk->count);
+    for (int i = 0; i < chunk->count; i++) {
+        writeU32(&writer, (uint32_t)chunk->lines[i]);
+    }
+    writeU32(&writer, (uint32_t)chunk->constants.count);
+    for (int i = 0; i < chunk->constants.count; i++) {
+        writeConstant(&writer, chunk->constants.values[i]);
+    }
+    writeGlobals(&writer, vm, chunk, codeStart);
+
+    // Hand back an exactly-sized buffer so the caller can free it knowing
+    // only the length.
+    writer.bytes = GROW_ARRAY(writer.heap, writer.bytes, uint8_t, writer.capacity, writer.length);
+    *length = writer.length;
+    return writer.bytes;
+}
+
+typedef struct {
+    const uint8_t* bytes;
+    size_t length;
+    size_t position;
+    bool failed;
+} Reader;
+
+static const uint8_t* readBytes(Reader* reader, size_t length)
+{
+    if (reader->failed || reader->length - reader->position < length) {
+        reader->failed = true;
+        return NULL;
+    }
+    const uint8_t* bytes = reader->bytes + reader->position;
+    reader->position += length;
+    return bytes;
+}
+
+static uint8_t readU8(Reader* reader)
+{
+    const uint8_t* bytes = readBytes(reader, 1);
+    return bytes == NULL ? 0 : bytes[0];
+}
+
+static uint64_t readUnsigned(Reader* reader, int size)
+{
+    const uint8_t* bytes = readBytes(reader, size);
+    uint64_t value = 0;
+    for (int i = 0; bytes != NULL && i < size; i++) {
+        value |= (uint64_t)bytes[i] << (8 * i);
+    }
+    return value;
+}
+
+// Counts stored as 32 bits must still fit the int fields of Chunk.
+static int readCount(Reader* reader)
+{
+    uint32_t count = (uint32_t)readUnsigned(reader, 4);
+    if (count > INT32_MAX) {
+        reader->failed = true;
+        return 0;
+    }
+    return (int)count;
+}
+
+static Value readConstant(VM* vm, Reader* reader)
+{
+    switch (readU8(reader)) {
+    case CONSTANT_NIL:
+        return NIL_VAL;
+    case CONSTANT_BOOL:
+        return BOOL_VAL(readU8(reader) != 0);
+    case CONSTANT_NUMBER: {
+        uint64_t bits = readUnsigned(reader, 8);
+        double number;
+        memcpy(&number, &bits, sizeof(number));
+        return NUMBER_VAL(number);
+    }
+    case CONSTANT_INT:
+        return INT_VAL((int64_t)readUnsigned(reader, 8));
+    case CONSTANT_STRING: {
+        int length = readCount(reader);
+        const uint8_t* chars = readBytes(reader, length);
+        if (chars == NULL) {
+            return NIL_VAL;
+        }
+        return stringValue(vm, (const char*)chars, length);
+    }
+    case CONSTANT_NATIVE: {
+        int length = readCount(reader);
+        const uint8_t* name = readBytes(reader, length);
+        ObjNative* native = name == NULL ? NULL : findNative(vm, (const char*)name, length);
+        if (native == NULL) {
+            reader->failed = true;
+            return NIL_VAL;
+        }
+        return OBJ_VAL((Obj*)native);
+    }
+    default:
+        reader->failed = true;
+        return NIL_VAL;
+    }
+}
+
+// Declares the image's globals in `vm` and rewrites the chunk's global
+// operands to their slots. Stops at the first instruction that is not
+// well-formed, which the verifier will reject.
+static bool readGlobals(VM* vm, Reader* reader, Chunk* chunk)
+{
+    // Each name takes at least its four-byte length.
+    int count = readCount(reader);
+    if (reader->failed || count > GLOBALS_MAX || (size_t)count > (reader->length - reader->position) / 4) {
+        return false;
+    }
+    int* slots = ALLOCATE(&systemHeap, int, count + 1);
+    bool valid = true;
+    for (int i = 0; i < count && valid; i++) {
+        int length = readCount(reader);
+        const uint8_t* name = readBytes(reader, length);
+        slots[i] = name == NULL ? -1 : declareGlobal(&vm->globals, (const char*)name, length);
+        valid = slots[i] >= 0;
+    }
+
+    for (int offset = 0; offset < chunk->count && valid;) {
+        uint8_t instruction = chunk->code[offset];
+        if (instruction >= OP_COUNT || offset + opInfo[instruction].operandBytes >= chunk->count) {
+            break;
+        }
+        if (isGlobalInstruction(instruction)) {
+            int index = chunk->code[offset + 1] << 8 | chunk->code[offset + 2];
+            if (index >= count) {
+                valid = false;
+                break;
+            }
+            chunk->code[offset + 1] = (uint8_t)(slots[index] >> 8);
+            chunk->code[offset + 2] = (uint8_t)slots[index];
+        }
+        offset += 1 + opInfo[instruction].operandBytes;
+    }
+    FREE_ARRAY(&systemHeap, int, slots, count + 1);
+    return valid;
+}
+
+bool deserializeChunk(VM* vm, const uint8_t* bytes, size_t length, Chunk* chunk)
+{
+    Reader reader = (Reader) { .bytes = bytes, .length = length, .position = 0, .failed = false };
+    initChunk(chunk, &vm->heap);
+
+    const uint8_t* magic = readBytes(&reader, 4);
+    if (magic == NULL || memcmp(magic, CHUNK_MAGIC, 4) != 0
+        || readUnsigned(&reader, 4) != CHUNK_VERSION) {
+        return false;
+    }
+
+    int count = readCount(&reader);
+    int maxStack = readCount(&reader);
+    const uint8_t* code = readBytes(&reader, count);
+    // Each line takes four bytes; reject a count the image cannot hold before
+    // allocating for it.
+    if (code == NULL || (length - reader.position) / 4 < (size_t)count) {
+        return false;
+    }
+    for (int i = 0; i < count; i++) {
+        writeChunk(chunk, code[i], (int)readUnsigned(&reader, 4));
+    }
+    chunk->maxStack = maxStack;
+
+    // OP_CONSTANT can only reach the first UINT8_MAX + 1 constants, and each
+    // takes at least its tag byte.
+    int constantCount = readCount(&reader);
+    if (constantCount > UINT8_MAX + 1 || (size_t)constantCount > length - reader.position) {
+        freeChunk(chunk);
+        return false;
+    }
+    for (int i = 0; i < constantCount && !reader.failed; i++) {
+        addConstant(chunk, readConstant(vm, &reader));
+    }
+
+    int globalCount = vm->globals.count;
+    if (!reader.failed && !readGlobals(vm, &reader, chunk)) {
+        reader.failed = true;
+    }
+    if (reader.failed || reader.position != length) {
+        forgetGlobals(&vm->globals, globalCount);
+        freeChunk(chunk);
+        return false;
+    }
+    return true;
+}
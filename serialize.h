@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "chunk.h"
+#include "vm.h"
+
+// A portable image of a compiled chunk: little-endian, with constants stored
+// by value and natives and globals by name, so it can be loaded into any VM.
+// `vm` is the VM the chunk was compiled in. Returns a buffer from the chunk's
+// heap; free it with FREE_ARRAY(chunk->heap, uint8_t, ...).
+uint8_t* serializeChunk(VM* vm, Chunk* chunk, size_t* length);
+// Rebuilds a chunk from an image, creating its string constants in `vm` and
+// declaring its globals there.
+// Returns false on a malformed image. The result still has to be verified
+// before it runs, which interpretChunk() does.
+bool deserializeChunk(VM* vm, const uint8_t* bytes, size_t length, Chunk* chunk);
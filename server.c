@@ -0,0 +1,426 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#include "memory.h"
+#include "server.h"
+#include "vm.h"
+
+#ifdef __linux__
+
+#define MAX_EVENTS 64
+#define MAX_BUFFERED ((size_t)SERVE_HEADER_SIZE + SERVE_MAX_PAYLOAD)
+// No more requests are evaluated while this much output waits to be sent.
+#define MAX_UNSENT ((size_t)1 << 20)
+// Connections beyond this many are closed as soon as they are accepted.
+#define MAX_CONNECTIONS 1024
+// A VM never frees the objects its evaluations leave behind, so one goes
+// back to the pool only if there is room and it has stayed small; otherwise
+// it is freed and a later connection gets a fresh one.
+#define MAX_IDLE_VMS 64
+#define MAX_POOLED_VM_BYTES ((size_t)8 << 20)
+
+// Each connection evaluates in its own VM so scripts cannot see each other's
+// objects. VMs go back to a pool when the client disconnects and are handed
+// out again warm: stack allocated, natives installed, chunk cache filled.
+// See MAX_IDLE_VMS for which ones.
+typedef struct {
+    int fd;
+    VM* vm;
+    uint8_t* in;
+    size_t inLength;
+    size_t inCapacity;
+    uint8_t* out;
+    size_t outLength;
+    size_t outCapacity;
+    size_t outSent;
+    uint32_t events; // what the connection is registered for
+    bool closing; // the client has shut down its side
+} Connection;
+
+typedef struct {
+    int epoll;
+    int listener;
+    int connectionCount;
+    VM** idle;
+    int idleCount;
+    int idleCapacity;
+} Server;
+
+static volatile sig_atomic_t stopping = 0;
+
+static void onStop(int signal)
+{
+    (void)signal;
+    stopping = 1;
+}
+
+static VM* takeVM(Server* server)
+{
+    if (server->idleCount > 0) {
+        return server->idle[--server->idleCount];
+    }
+    VM* vm = ALLOCATE(&systemHeap, VM, 1);
+    initVM(vm);
+    outputToMemory(&vm->out);
+    setMemoryLimit(vm, SERVE_MEMORY_LIMIT);
+    return vm;
+}
+
+static void freePooledVM(VM* vm)
+{
+    freeVM(vm);
+    FREE(&systemHeap, VM, vm);
+}
+
+// The next connection starts with no globals defined. Their slots stay, as
+// the VM's cached chunks refer to them.
+static void releaseVM(Server* server, VM* vm)
+{
+    if (server->idleCount == MAX_IDLE_VMS || vm->heap.bytes > MAX_POOLED_VM_BYTES) {
+        freePooledVM(vm);
+        return;
+    }
+    resetGlobals(&vm->globals);
+    if (server->idleCapacity < server->idleCount + 1) {
+        int oldCapacity = server->idleCapacity;
+        server->idleCapacity = GROW_CAPACITY(oldCapacity);
+        server->idle = GROW_ARRAY(&systemHeap, server->idle, VM*, oldCapacity, server->idleCapacity);
+    }
+    server->idle[server->idleCount++] = vm;
+}
+
+static void reserveBytes(uint8_t** bytes, size_t* capacity, size_t needed)
+{
+    if (*capacity >= needed) {
+        return;
+    }
+    size_t oldCapacity = *capacity;
+    size_t newCapacity = GROW_CAPACITY(oldCapacity);
+    while (newCapacity < needed) {
+        newCapacity *= 2;
+    }
+    *bytes = GROW_ARRAY(&systemHeap, *bytes, uint8_t, oldCapacity, newCapacity);
+    *capacity = newCapacity;
+}
+
+static void closeConnection(Server* server, Connection* connection)
+{
+    epoll_ctl(server->epoll, EPOLL_CTL_DEL, connection->fd, NULL);
+    close(connection->fd);
+    releaseVM(server, connection->vm);
+    FREE_ARRAY(&systemHeap, uint8_t, connection->in, connection->inCapacity);
+    FREE_ARRAY(&systemHeap, uint8_t, connection->out, connection->outCapacity);
+    FREE(&systemHeap, Connection, connection);
+    server->connectionCount--;
+}
+
+static void putHeader(uint8_t* header, uint8_t kind, uint32_t length)
+{
+    header[0] = kind;
+    for (int i = 0; i < 4; i++) {
+        header[1 + i] = (uint8_t)(length >> (8 * i));
+    }
+}
+
+static void respond(Connection* connection, InterpretResult result)
+{
+    Output* out = &connection->vm->out;
+    flushOutput(out);
+    size_t length = out->memoryLength;
+
+    reserveBytes(&connection->out, &connection->outCapacity,
+        connection->outLength + SERVE_HEADER_SIZE + length);
+    uint8_t* message = connection->out + connection->outLength;
+    putHeader(message, (uint8_t)result, (uint32_t)length);
+    memcpy(message + SERVE_HEADER_SIZE, out->memory, length);
+    connection->outLength += SERVE_HEADER_SIZE + length;
+    out->memoryLength = 0;
+}
+
+static bool evaluate(Connection* connection, uint8_t kind, uint8_t* payload, uint32_t length)
+{
+    VM* vm = connection->vm;
+    InterpretResult result;
+    if (kind == SERVE_SOURCE) {
+        // The input buffer always has a spare byte for the terminator.
+        uint8_t saved = payload[length];
+        payload[length] = '\0';
+        result = interpretWithFuel(vm, (const char*)payload, SERVE_FUEL);
+        payload[length] = saved;
+    } else if (kind == SERVE_CHUNK) {
+        result = interpretImage(vm, payload, length, SERVE_FUEL);
+    } else {
+        return false;
+    }
+    // The suspended evaluation is discarded by the next one.
+    if (result == INTERPRET_YIELD) {
+        fprintf(stderr, "Out of fuel.\n");
+        result = INTERPRET_RUNTIME_ERROR;
+    }
+    respond(connection, result);
+    return true;
+}
+
+static uint32_t payloadLength(const uint8_t* header)
+{
+    uint32_t length = 0;
+    for (int i = 0; i < 4; i++) {
+        length |= (uint32_t)header[1 + i] << (8 * i);
+    }
+    return length;
+}
+
+// Whether the input buffer starts with a complete request.
+static bool requestWaiting(Connection* connection)
+{
+    return connection->inLength >= SERVE_HEADER_SIZE
+        && connection->inLength - SERVE_HEADER_SIZE >= payloadLength(connection->in);
+}
+
+// Evaluates the complete requests in the input buffer, stopping early once
+// MAX_UNSENT bytes of responses are waiting for a client that does not read
+// them. Returns false if the client broke the protocol.
+static bool handleRequests(Connection* connection)
+{
+    size_t position = 0;
+    while (connection->inLength - position >= SERVE_HEADER_SIZE
+        && connection->outLength - connection->outSent < MAX_UNSENT) {
+        uint8_t* header = connection->in + position;
+        uint32_t length = payloadLength(header);
+        if (length > SERVE_MAX_PAYLOAD) {
+            return false;
+        }
+        if (connection->inLength - position - SERVE_HEADER_SIZE < length) {
+            break;
+        }
+        if (!evaluate(connection, header[0], header + SERVE_HEADER_SIZE, length)) {
+            return false;
+        }
+        position += SERVE_HEADER_SIZE + length;
+    }
+
+    memmove(connection->in, connection->in + position, connection->inLength - position);
+    connection->inLength -= position;
+    return true;
+}
+
+// Sends as much pending output as the socket takes. Watches for writability
+// only while some is left, and for readability only while none is, so a
+// client has to take its responses before it gets to send more; reading
+// stops for good once the client has finished sending.
+static bool flushConnection(Server* server, Connection* connection)
+{
+    while (connection->outSent < connection->outLength) {
+        ssize_t sent = send(connection->fd, connection->out + connection->outSent,
+            connection->outLength - connection->outSent, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return false;
+        }
+        connection->outSent += (size_t)sent;
+    }
+
+    bool pending = connection->outSent < connection->outLength;
+    if (!pending) {
+        connection->outSent = 0;
+        connection->outLength = 0;
+    }
+    uint32_t events = (connection->closing || pending ? 0 : EPOLLIN) | (pending ? EPOLLOUT : 0);
+    if (events != connection->events) {
+        struct epoll_event event = { .events = events, .data.ptr = connection };
+        epoll_ctl(server->epoll, EPOLL_CTL_MOD, connection->fd, &event);
+        connection->events = events;
+    }
+    return true;
+}
+
+// Returns false once the client has closed its side or the socket failed.
+// Reads no further than one largest request: handleRequests() can always
+// consume or reject a buffer that full, and the rest waits in the socket
+// until it has, as the connection is still readable.
+static bool readConnection(Connection* connection)
+{
+    while (connection->inLength < MAX_BUFFERED) {
+        // One spare byte so a source payload at the very end can be
+        // NUL-terminated in place.
+        size_t needed = connection->inLength + 4096;
+        reserveBytes(&connection->in, &connection->inCapacity,
+            (needed < MAX_BUFFERED ? needed : MAX_BUFFERED) + 1);
+        size_t room = connection->inCapacity - 1;
+        if (room > MAX_BUFFERED) {
+            room = MAX_BUFFERED;
+        }
+        ssize_t received = recv(connection->fd, connection->in + connection->inLength,
+            room - connection->inLength, 0);
+        if (received > 0) {
+            connection->inLength += (size_t)received;
+            continue;
+        }
+        if (received == 0) {
+            return false;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    return true;
+}
+
+static void acceptConnections(Server* server)
+{
+    for (;;) {
+        int fd = accept4(server->listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        if (server->connectionCount == MAX_CONNECTIONS) {
+            close(fd);
+            continue;
+        }
+
+        Connection* connection = ALLOCATE(&systemHeap, Connection, 1);
+        *connection = (Connection) {
+            .fd = fd,
+            .vm = takeVM(server),
+            .events = EPOLLIN,
+            .closing = false,
+        };
+        struct epoll_event event = { .events = EPOLLIN, .data.ptr = connection };
+        if (epoll_ctl(server->epoll, EPOLL_CTL_ADD, fd, &event) < 0) {
+            close(fd);
+            releaseVM(server, connection->vm);
+            FREE(&systemHeap, Connection, connection);
+            continue;
+        }
+        server->connectionCount++;
+    }
+}
+
+static void serviceConnection(Server* server, Connection* connection, uint32_t events)
+{
+    // A client that half-closes still gets the responses to the requests
+    // it managed to send.
+    if ((events & EPOLLIN) && !readConnection(connection)) {
+        connection->closing = true;
+    }
+    // Requests left in the buffer because of unsent output are taken up as
+    // soon as it has all gone.
+    do {
+        if (!handleRequests(connection) || (events & (EPOLLERR | EPOLLHUP))
+            || !flushConnection(server, connection)) {
+            closeConnection(server, connection);
+            return;
+        }
+    } while (connection->outLength == 0 && requestWaiting(connection));
+    if (connection->closing && connection->outLength == 0) {
+        closeConnection(server, connection);
+    }
+}
+
+static int listenOn(const char* path)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path \"%s\" is too long.\n", path);
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        fprintf(stderr, "Could not listen on \"%s\": %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int serve(const char* path)
+{
+    Server server = (Server) {
+        .epoll = epoll_create1(EPOLL_CLOEXEC),
+        .listener = listenOn(path),
+        .connectionCount = 0,
+        .idle = NULL,
+        .idleCount = 0,
+        .idleCapacity = 0,
+    };
+    if (server.epoll < 0 || server.listener < 0) {
+        return 71;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onStop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = NULL };
+    epoll_ctl(server.epoll, EPOLL_CTL_ADD, server.listener, &event);
+
+    struct epoll_event events[MAX_EVENTS];
+    while (!stopping) {
+        int count = epoll_wait(server.epoll, events, MAX_EVENTS, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.ptr == NULL) {
+                acceptConnections(&server);
+            } else {
+                serviceConnection(&server, events[i].data.ptr, events[i].events);
+            }
+        }
+    }
+
+    // Connections still open at shutdown are dropped with the process; their
+    // VMs are not in the pool.
+    close(server.listener);
+    close(server.epoll);
+    unlink(path);
+    for (int i = 0; i < server.idleCount; i++) {
+        freePooledVM(server.idle[i]);
+    }
+    FREE_ARRAY(&systemHeap, VM*, server.idle, server.idleCapacity);
+    return 0;
+}
+
+#else
+
+int serve(const char* path)
+{
+    (void)path;
+    fprintf(stderr, "--serve needs Linux (epoll).\n");
+    return 64;
+}
+
+#endif
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+
+// Wire protocol of `clox --serve`. Every message in either direction is a
+// 5-byte header, a kind or status byte followed by a little-endian uint32
+// payload length, and then the payload. A connection may pipeline requests;
+// responses come back in order.
+//
+// Requests carry either source text or a chunk image (see serialize.h).
+// Responses carry the InterpretResult as status and everything the program
+// printed as payload. Diagnostics still go to the server's stderr. A client
+// that declares a payload over SERVE_MAX_PAYLOAD is disconnected.
+#define SERVE_HEADER_SIZE 5
+#define SERVE_MAX_PAYLOAD (64u << 20)
+// What one request may use. A request that runs out of either gets a
+// runtime error; the connection and its VM stay usable.
+#define SERVE_MEMORY_LIMIT ((size_t)512 << 20)
+#define SERVE_FUEL 10000000L
+
+typedef enum {
+    SERVE_SOURCE = 0,
+    SERVE_CHUNK = 1,
+} ServeRequestKind;
+
+// Listens on a Unix socket at `path` until SIGINT or SIGTERM. Returns a
+// process exit status.
+int serve(const char* path);
@@ -0,0 +1,471 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "compiler.h"
+#include "globals.h"
+#include "memory.h"
+#include "object.h"
+#include "scanner.h"
+#include "sheet.h"
+#include "verifier.h"
+
+void initSheet(Sheet* sheet, VM* vm)
+{
+    *sheet = (Sheet) {
+        .vm = vm,
+        .cells = NULL,
+        .count = 0,
+        .capacity = 0,
+        .cellOf = NULL,
+        .readers = NULL,
+        .visited = NULL,
+        .slotCapacity = 0,
+        .generation = 0,
+        .queue = NULL,
+        .queueCount = 0,
+        .queueCapacity = 0,
+        .changed = NULL,
+        .changedCount = 0,
+        .changedCapacity = 0,
+    };
+}
+
+void freeSheet(Sheet* sheet)
+{
+    Heap* heap = &sheet->vm->heap;
+    for (int i = 0; i < sheet->count; i++) {
+        // The globals still hold the values, so the VM frees them.
+        if (sheet->cells[i].owned != NULL) {
+            adoptObject(sheet->vm, sheet->cells[i].owned);
+        }
+        freeChunk(&sheet->cells[i].chunk);
+        FREE_ARRAY(heap, int, sheet->cells[i].reads, sheet->cells[i].readCount);
+    }
+    for (int i = 0; i < sheet->slotCapacity; i++) {
+        FREE_ARRAY(heap, int, sheet->readers[i].cells, sheet->readers[i].capacity);
+    }
+    FREE_ARRAY(heap, Cell, sheet->cells, sheet->capacity);
+    FREE_ARRAY(heap, int, sheet->cellOf, sheet->slotCapacity);
+    FREE_ARRAY(heap, Readers, sheet->readers, sheet->slotCapacity);
+    FREE_ARRAY(heap, unsigned, sheet->visited, sheet->slotCapacity);
+    FREE_ARRAY(heap, int, sheet->queue, sheet->queueCapacity);
+    FREE_ARRAY(heap, int, sheet->changed, sheet->changedCapacity);
+    initSheet(sheet, sheet->vm);
+}
+
+static void appendInt(Heap* heap, int** items, int* count, int* capacity, int item)
+{
+    if (*capacity < *count + 1) {
+        int oldCapacity = *capacity;
+        *capacity = GROW_CAPACITY(oldCapacity);
+        *items = GROW_ARRAY(heap, *items, int, oldCapacity, *capacity);
+    }
+    (*items)[(*count)++] = item;
+}
+
+// Makes the arrays indexed by slot cover every global declared so far.
+static void coverSlots(Sheet* sheet)
+{
+    int slots = sheet->vm->globals.count;
+    if (sheet->slotCapacity >= slots) {
+        return;
+    }
+    Heap* heap = &sheet->vm->heap;
+    int oldCapacity = sheet->slotCapacity;
+    int capacity = oldCapacity;
+    while (capacity < slots) {
+        capacity = GROW_CAPACITY(capacity);
+    }
+    sheet->cellOf = GROW_ARRAY(heap, sheet->cellOf, int, oldCapacity, capacity);
+    sheet->readers = GROW_ARRAY(heap, sheet->readers, Readers, oldCapacity, capacity);
+    sheet->visited = GROW_ARRAY(heap, sheet->visited, unsigned, oldCapacity, capacity);
+    for (int i = oldCapacity; i < capacity; i++) {
+        sheet->cellOf[i] = -1;
+        sheet->readers[i] = (Readers) { .cells = NULL, .count = 0, .capacity = 0 };
+        sheet->visited[i] = 0;
+    }
+    sheet->slotCapacity = capacity;
+}
+
+// Starts a walk over the slots: none counts as visited afterwards.
+static unsigned beginWalk(Sheet* sheet)
+{
+    if (++sheet->generation == 0) {
+        memset(sheet->visited, 0, sizeof(unsigned) * sheet->slotCapacity);
+        sheet->generation = 1;
+    }
+    return sheet->generation;
+}
+
+static int heightOf(Sheet* sheet, int slot)
+{
+    int cell = sheet->cellOf[slot];
+    return cell < 0 ? 0 : sheet->cells[cell].height;
+}
+
+static void enqueue(Sheet* sheet, int cell)
+{
+    if (!sheet->cells[cell].queued) {
+        sheet->cells[cell].queued = true;
+        appendInt(&sheet->vm->heap, &sheet->queue, &sheet->queueCount, &sheet->queueCapacity, cell);
+    }
+}
+
+static bool lower(Sheet* sheet, int a, int b)
+{
+    return sheet->cells[sheet->queue[a]].height < sheet->cells[sheet->queue[b]].height;
+}
+
+static void swapQueued(Sheet* sheet, int a, int b)
+{
+    int cell = sheet->queue[a];
+    sheet->queue[a] = sheet->queue[b];
+    sheet->queue[b] = cell;
+}
+
+static void siftUp(Sheet* sheet, int child)
+{
+    while (child > 0 && lower(sheet, child, (child - 1) / 2)) {
+        swapQueued(sheet, child, (child - 1) / 2);
+        child = (child - 1) / 2;
+    }
+}
+
+static void siftDown(Sheet* sheet, int parent)
+{
+    for (;;) {
+        int lowest = parent;
+        int left = 2 * parent + 1;
+        if (left < sheet->queueCount && lower(sheet, left, lowest)) {
+            lowest = left;
+        }
+        if (left + 1 < sheet->queueCount && lower(sheet, left + 1, lowest)) {
+            lowest = left + 1;
+        }
+        if (lowest == parent) {
+            return;
+        }
+        swapQueued(sheet, parent, lowest);
+        parent = lowest;
+    }
+}
+
+// Adds to the queue once it is a heap.
+static void pushQueued(Sheet* sheet, int cell)
+{
+    if (!sheet->cells[cell].queued) {
+        enqueue(sheet, cell);
+        siftUp(sheet, sheet->queueCount - 1);
+    }
+}
+
+static int popQueued(Sheet* sheet)
+{
+    int cell = sheet->queue[0];
+    sheet->queue[0] = sheet->queue[--sheet->queueCount];
+    siftDown(sheet, 0);
+    sheet->cells[cell].queued = false;
+    return cell;
+}
+
+// Collects the distinct global slots the chunk reads. Returns false if it
+// writes any: dependents would never see what a cell stored elsewhere.
+static bool collectReads(Sheet* sheet, Chunk* chunk, int** reads, int* count)
+{
+    Heap* heap = &sheet->vm->heap;
+    unsigned walk = beginWalk(sheet);
+    int capacity = 0;
+    *reads = NULL;
+    *count = 0;
+    for (int offset = 0; offset < chunk->count; offset += 1 + opInfo[chunk->code[offset]].operandBytes) {
+        OpCode instruction = chunk->code[offset];
+        if (instruction == OP_SET_GLOBAL || instruction == OP_DEFINE_GLOBAL) {
+            FREE_ARRAY(heap, int, *reads, capacity);
+            return false;
+        }
+        if (instruction != OP_GET_GLOBAL) {
+            continue;
+        }
+        int slot = chunk->code[offset + 1] << 8 | chunk->code[offset + 2];
+        if (sheet->visited[slot] != walk) {
+            sheet->visited[slot] = walk;
+            appendInt(heap, reads, count, &capacity, slot);
+        }
+    }
+    // Trim to the count, which is what the array is freed with.
+    *reads = GROW_ARRAY(heap, *reads, int, capacity, *count);
+    return true;
+}
+
+// Whether a cell in `slot` that reads `reads` would depend on itself: that
+// is, whether it reads its own slot or that of a cell downstream of it.
+static bool makesCycle(Sheet* sheet, int slot, int* reads, int readCount)
+{
+    // Cells downstream are higher than the one in `slot`, so unless it
+    // reads one of those, or itself, there is nothing to walk.
+    int height = heightOf(sheet, slot);
+    bool possible = false;
+    for (int i = 0; i < readCount && !possible; i++) {
+        possible = reads[i] == slot || heightOf(sheet, reads[i]) > height;
+    }
+    if (!possible) {
+        return false;
+    }
+
+    Heap* heap = &sheet->vm->heap;
+    unsigned walk = beginWalk(sheet);
+    int* pending = NULL;
+    int pendingCount = 0;
+    int pendingCapacity = 0;
+
+    sheet->visited[slot] = walk;
+    appendInt(heap, &pending, &pendingCount, &pendingCapacity, slot);
+    while (pendingCount > 0) {
+        Readers* readers = &sheet->readers[pending[--pendingCount]];
+        for (int i = 0; i < readers->count; i++) {
+            int next = sheet->cells[readers->cells[i]].slot;
+            if (sheet->visited[next] != walk) {
+                sheet->visited[next] = walk;
+                appendInt(heap, &pending, &pendingCount, &pendingCapacity, next);
+            }
+        }
+    }
+    FREE_ARRAY(heap, int, pending, pendingCapacity);
+
+    for (int i = 0; i < readCount; i++) {
+        if (sheet->visited[reads[i]] == walk) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Restores the invariant that a cell is higher than every cell it reads
+// after the cell in `slot` rose. Heights never fall: a cell that is higher
+// than it needs to be still runs after everything it reads.
+static void raiseReaders(Sheet* sheet, int slot)
+{
+    Heap* heap = &sheet->vm->heap;
+    int* pending = NULL;
+    int pendingCount = 0;
+    int pendingCapacity = 0;
+
+    appendInt(heap, &pending, &pendingCount, &pendingCapacity, slot);
+    while (pendingCount > 0) {
+        int current = pending[--pendingCount];
+        int height = heightOf(sheet, current);
+        Readers* readers = &sheet->readers[current];
+        for (int i = 0; i < readers->count; i++) {
+            Cell* reader = &sheet->cells[readers->cells[i]];
+            if (reader->height <= height) {
+                reader->height = height + 1;
+                appendInt(heap, &pending, &pendingCount, &pendingCapacity, reader->slot);
+            }
+        }
+    }
+    FREE_ARRAY(heap, int, pending, pendingCapacity);
+}
+
+static void removeReader(Readers* readers, int cell)
+{
+    for (int i = 0; i < readers->count; i++) {
+        if (readers->cells[i] == cell) {
+            readers->cells[i] = readers->cells[--readers->count];
+            return;
+        }
+    }
+}
+
+// A cell is named like a variable, and not like a builtin, which the
+// compiler resolves before it looks at globals.
+static bool isCellName(VM* vm, const char* name, int length)
+{
+    if (length == 0 || length > 255 || !(isalpha((unsigned char)name[0]) || name[0] == '_')) {
+        return false;
+    }
+    for (int i = 1; i < length; i++) {
+        if (!isalnum((unsigned char)name[i]) && name[i] != '_') {
+            return false;
+        }
+    }
+    char copy[256];
+    memcpy(copy, name, length);
+    copy[length] = '\0';
+    Scanner scanner;
+    initScanner(&scanner, copy);
+    return scanToken(&scanner).type == TOKEN_IDENTIFIER && findNative(vm, name, length) == NULL;
+}
+
+int findCell(Sheet* sheet, const char* name, int length)
+{
+    int slot = findGlobal(&sheet->vm->globals, name, length);
+    if (slot < 0 || slot >= sheet->slotCapacity) {
+        return -1;
+    }
+    return sheet->cellOf[slot];
+}
+
+static int addCell(Sheet* sheet, int slot)
+{
+    Heap* heap = &sheet->vm->heap;
+    if (sheet->capacity < sheet->count + 1) {
+        int oldCapacity = sheet->capacity;
+        sheet->capacity = GROW_CAPACITY(oldCapacity);
+        sheet->cells = GROW_ARRAY(heap, sheet->cells, Cell, oldCapacity, sheet->capacity);
+    }
+    int cell = sheet->count++;
+    sheet->cells[cell] = (Cell) {
+        .slot = slot,
+        .reads = NULL,
+        .readCount = 0,
+        .height = 0,
+        .queued = false,
+        .owned = NULL,
+        .replaced = NULL,
+    };
+    initChunk(&sheet->cells[cell].chunk, heap);
+    sheet->cellOf[slot] = cell;
+    return cell;
+}
+
+bool setCell(Sheet* sheet, const char* name, int length, const char* source)
+{
+    VM* vm = sheet->vm;
+    if (!isCellName(vm, name, length)) {
+        fprintf(stderr, "Invalid cell name '%.*s'.\n", length, name);
+        return false;
+    }
+    int slot = declareGlobal(&vm->globals, name, length);
+    if (slot < 0) {
+        fprintf(stderr, "Too many global variables.\n");
+        return false;
+    }
+
+    Chunk chunk;
+    initChunk(&chunk, &vm->heap);
+    if (!compile(vm, source, &chunk)) {
+        freeChunk(&chunk);
+        return false;
+    }
+    const char* error;
+    int offset;
+    if (!verifyChunk(&chunk, vm->globals.count, &error, &offset)) {
+        fprintf(stderr, "Invalid bytecode at offset %d: %s\n", offset, error);
+        freeChunk(&chunk);
+        return false;
+    }
+    // Compiling may have declared globals for names not seen before.
+    coverSlots(sheet);
+
+    int* reads;
+    int readCount;
+    if (!collectReads(sheet, &chunk, &reads, &readCount)) {
+        fprintf(stderr, "Cell '%.*s' assigns to a variable.\n", length, name);
+        freeChunk(&chunk);
+        return false;
+    }
+    if (makesCycle(sheet, slot, reads, readCount)) {
+        fprintf(stderr, "Cell '%.*s' depends on itself.\n", length, name);
+        FREE_ARRAY(&vm->heap, int, reads, readCount);
+        freeChunk(&chunk);
+        return false;
+    }
+
+    int cell = sheet->cellOf[slot];
+    if (cell < 0) {
+        cell = addCell(sheet, slot);
+    }
+    Cell* target = &sheet->cells[cell];
+    for (int i = 0; i < target->readCount; i++) {
+        removeReader(&sheet->readers[target->reads[i]], cell);
+    }
+    FREE_ARRAY(&vm->heap, int, target->reads, target->readCount);
+    freeChunk(&target->chunk);
+    target->chunk = chunk;
+    target->reads = reads;
+    target->readCount = readCount;
+
+    int height = 0;
+    for (int i = 0; i < readCount; i++) {
+        Readers* readers = &sheet->readers[reads[i]];
+        appendInt(&vm->heap, &readers->cells, &readers->count, &readers->capacity, cell);
+        int above = heightOf(sheet, reads[i]) + 1;
+        height = above > height ? above : height;
+    }
+    if (height > target->height) {
+        target->height = height;
+        raiseReaders(sheet, slot);
+    }
+    enqueue(sheet, cell);
+    return true;
+}
+
+Value cellValue(Sheet* sheet, int cell)
+{
+    return sheet->vm->globals.values[sheet->cells[cell].slot];
+}
+
+static bool sameValue(Value a, Value b)
+{
+    if (IS_UNDEFINED(a) || IS_UNDEFINED(b)) {
+        return IS_UNDEFINED(a) && IS_UNDEFINED(b);
+    }
+    return valuesEqual(a, b);
+}
+
+InterpretResult recalculate(Sheet* sheet)
+{
+    VM* vm = sheet->vm;
+    InterpretResult status = INTERPRET_OK;
+    sheet->changedCount = 0;
+
+    for (int i = sheet->queueCount / 2 - 1; i >= 0; i--) {
+        siftDown(sheet, i);
+    }
+    while (sheet->queueCount > 0) {
+        Cell* cell = &sheet->cells[popQueued(sheet)];
+        Obj* newest = vm->objects;
+        Value value;
+        if (runChunk(vm, &cell->chunk, &value) != INTERPRET_OK) {
+            value = UNDEFINED_VAL;
+            status = INTERPRET_RUNTIME_ERROR;
+        }
+        // A string runChunk() copied out of scratch is the newest object, and
+        // a cell cannot assign, so nothing else refers to it.
+        Obj* copied = NULL;
+        if (IS_OBJ(value) && vm->objects != newest && AS_OBJ(value) == vm->objects) {
+            copied = takeNewestObject(vm);
+        }
+
+        Value* stored = &vm->globals.values[cell->slot];
+        if (sameValue(*stored, value)) {
+            if (copied != NULL) {
+                freeObject(vm, copied);
+            }
+            continue;
+        }
+        *stored = value;
+        cell->replaced = cell->owned;
+        cell->owned = copied;
+        int index = (int)(cell - sheet->cells);
+        appendInt(&vm->heap, &sheet->changed, &sheet->changedCount, &sheet->changedCapacity, index);
+        // Everything that reads the cell is higher, so it comes off the
+        // queue after this cell and after anything else it reads.
+        Readers* readers = &sheet->readers[cell->slot];
+        for (int i = 0; i < readers->count; i++) {
+            pushQueued(sheet, readers->cells[i]);
+        }
+    }
+
+    // A cell that returned another cell's value as it was reads that cell,
+    // so it has run again by now and no longer holds a replaced value.
+    for (int i = 0; i < sheet->changedCount; i++) {
+        Cell* cell = &sheet->cells[sheet->changed[i]];
+        if (cell->replaced != NULL) {
+            freeObject(vm, cell->replaced);
+            cell->replaced = NULL;
+        }
+    }
+    return status;
+}
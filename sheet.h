@@ -0,0 +1,73 @@
+#pragma once
+
+#include "chunk.h"
+#include "common.h"
+#include "vm.h"
+
+// One named expression. Its value lives in the global of the same name, so
+// other cells read it like any variable.
+typedef struct {
+    int slot; // of the global holding the value
+    Chunk chunk; // compiled once, when the expression is set
+    int* reads; // global slots the chunk reads, each once
+    int readCount;
+    int height; // greater than the height of every cell it reads
+    bool queued;
+    // The string holding the value when it was copied for this cell alone.
+    // It is kept off vm->objects, so that the cell can free it once the value
+    // is replaced, which it does at the end of the recalculation.
+    Obj* owned;
+    Obj* replaced;
+} Cell;
+
+// The cells that read one global.
+typedef struct {
+    int* cells;
+    int count;
+    int capacity;
+} Readers;
+
+// A spreadsheet of named expressions evaluated on one VM. Setting a cell
+// compiles its expression and records the globals it reads; recalculating
+// runs only cells whose inputs changed since they last ran, lowest first,
+// and leaves the rest with the values they already hold. A cell whose new
+// value equals its old one stops the change there, so an update costs time
+// in proportion to the cells it actually affects, not to the size of the
+// sheet.
+//
+// Only changes made through the sheet are seen: a cell that reads a global
+// the host assigns with interpret() is not rerun when that global changes.
+typedef struct {
+    VM* vm;
+    Cell* cells;
+    int count;
+    int capacity;
+    int* cellOf; // by global slot: the cell stored there, or -1
+    Readers* readers; // by global slot
+    unsigned* visited; // by global slot: the generation of the last walk there
+    int slotCapacity; // of the three above
+    unsigned generation;
+    // Cells to rerun. setCell() only appends; recalculate() turns the queue
+    // into a binary min-heap by height, since setting a cell can raise the
+    // heights of others.
+    int* queue;
+    int queueCount;
+    int queueCapacity;
+    int* changed; // cells whose value changed in the last recalculation
+    int changedCount;
+    int changedCapacity;
+} Sheet;
+
+void initSheet(Sheet* sheet, VM* vm);
+void freeSheet(Sheet* sheet);
+// Sets cell `name` to the expression `source` and queues it to run. Returns
+// false, leaving the cell as it was, if the source does not compile, assigns
+// to a variable or makes a cell depend on itself.
+bool setCell(Sheet* sheet, const char* name, int length, const char* source);
+// Runs every queued cell and whatever its change affects. Cells that fail
+// at runtime become undefined, so the cells reading them fail too.
+InterpretResult recalculate(Sheet* sheet);
+// The value of a cell; undefined (see globals.h) if it has none.
+Value cellValue(Sheet* sheet, int cell);
+// Returns the index of cell `name`, or -1 if there is none.
+int findCell(Sheet* sheet, const char* name, int length);
@@ -0,0 +1,268 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <string.h>
+
+#include "memory.h"
+#include "tokens.h"
+
+// A slice of the source tokenized by one thread. The thread starts at
+// `start` as if it were at a token boundary on line 1, which is only a guess:
+// the slice may begin inside a multi-line string. mergeJobs() checks the guess
+// against the tokens before it.
+typedef struct {
+    const char* source;
+    size_t start;
+    size_t end; // tokens starting here or later belong to the next job
+    bool last;
+    TokenStream tokens;
+    size_t stop; // where scanning the next job's tokens resumes
+    int stopLine;
+} TokenizeJob;
+
+void initTokenStream(TokenStream* stream, const char* source)
+{
+    *stream = (TokenStream) {
+        .source = source,
+        .count = 0,
+        .capacity = 0,
+        .types = NULL,
+        .offsets = NULL,
+        .lengths = NULL,
+        .lines = NULL,
+    };
+}
+
+void freeTokenStream(TokenStream* stream)
+{
+    FREE_ARRAY(&systemHeap, uint8_t, stream->types, stream->capacity);
+    FREE_ARRAY(&systemHeap, uint32_t, stream->offsets, stream->capacity);
+    FREE_ARRAY(&systemHeap, uint32_t, stream->lengths, stream->capacity);
+    FREE_ARRAY(&systemHeap, uint32_t, stream->lines, stream->capacity);
+    initTokenStream(stream, stream->source);
+}
+
+static void reserveTokens(TokenStream* stream, int count)
+{
+    if (stream->capacity >= count) {
+        return;
+    }
+    int oldCapacity = stream->capacity;
+    int capacity = GROW_CAPACITY(oldCapacity);
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    stream->types = GROW_ARRAY(&systemHeap, stream->types, uint8_t, oldCapacity, capacity);
+    stream->offsets = GROW_ARRAY(&systemHeap, stream->offsets, uint32_t, oldCapacity, capacity);
+    stream->lengths = GROW_ARRAY(&systemHeap, stream->lengths, uint32_t, oldCapacity, capacity);
+    stream->lines = GROW_ARRAY(&systemHeap, stream->lines, uint32_t, oldCapacity, capacity);
+    stream->capacity = capacity;
+}
+
+// Error tokens carry their message instead of a lexeme, so they are stored
+// by position and the message is recovered in tokenAt().
+static void appendToken(TokenStream* stream, Scanner* scanner, Token token, int lineDelta)
+{
+    reserveTokens(stream, stream->count + 1);
+    int i = stream->count++;
+    stream->types[i] = (uint8_t)token.type;
+    stream->offsets[i] = (uint32_t)(scanner->start - stream->source);
+    stream->lengths[i] = token.type == TOKEN_ERROR ? 0 : (uint32_t)token.length;
+    stream->lines[i] = (uint32_t)(token.line + lineDelta);
+}
+
+Token tokenAt(TokenStream* stream, int index)
+{
+    Token token = (Token) {
+        .type = (TokenType)stream->types[index],
+        .start = stream->source + stream->offsets[index],
+        .length = (int)stream->lengths[index],
+        .line = (int)stream->lines[index],
+    };
+    if (token.type == TOKEN_ERROR) {
+        // The scanner reports only these two errors.
+        token.start = *token.start == '"' ? "Unterminated string." : "Unexpected character.";
+        token.length = (int)strlen(token.start);
+    }
+    return token;
+}
+
+static void* runJob(void* argument)
+{
+    TokenizeJob* job = argument;
+    Scanner scanner = (Scanner) {
+        .start = job->source + job->start,
+        .current = job->source + job->start,
+        .line = 1,
+    };
+
+    for (;;) {
+        Scanner before = scanner;
+        Token token = scanToken(&scanner);
+        size_t offset = (size_t)(scanner.start - job->source);
+        if (!job->last && (token.type == TOKEN_EOF || offset >= job->end)) {
+            job->stop = (size_t)(before.current - job->source);
+            job->stopLine = before.line;
+            return NULL;
+        }
+        appendToken(&job->tokens, &scanner, token, 0);
+        if (token.type == TOKEN_EOF) {
+            return NULL;
+        }
+    }
+}
+
+// Index of the first token of `tokens` at or after `offset`.
+static int lowerBound(TokenStream* tokens, int from, uint32_t offset)
+{
+    int low = from;
+    int high = tokens->count;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (tokens->offsets[middle] < offset) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// Stitches the jobs together with a sequential scanner that only ever scans
+// the tokens no job got right. As soon as the sequential scanner produces a
+// token that starts where one of the job's tokens starts, the job's remaining
+// tokens are exactly what it would have produced (scanning depends only on the
+// position), so they are copied with their lines shifted.
+static void mergeJobs(TokenStream* stream, TokenizeJob* jobs, int jobCount)
+{
+    const char* source = stream->source;
+    Scanner scanner;
+    initScanner(&scanner, source);
+    Token token = scanToken(&scanner);
+
+    for (int k = 0; k < jobCount; k++) {
+        TokenStream* tokens = &jobs[k].tokens;
+        int match = 0;
+        for (;;) {
+            uint32_t offset = (uint32_t)(scanner.start - source);
+            match = lowerBound(tokens, match, offset);
+            if (match == tokens->count) {
+                break; // still before this job's first reliable token
+            }
+            if (tokens->offsets[match] == offset) {
+                break;
+            }
+            appendToken(stream, &scanner, token, 0);
+            token = scanToken(&scanner);
+        }
+        if (match == tokens->count) {
+            continue;
+        }
+
+        int lineDelta = token.line - (int)tokens->lines[match];
+        int copied = tokens->count - match;
+        reserveTokens(stream, stream->count + copied);
+        memcpy(stream->types + stream->count, tokens->types + match, copied * sizeof(uint8_t));
+        memcpy(stream->offsets + stream->count, tokens->offsets + match, copied * sizeof(uint32_t));
+        memcpy(stream->lengths + stream->count, tokens->lengths + match, copied * sizeof(uint32_t));
+        for (int i = 0; i < copied; i++) {
+            stream->lines[stream->count + i] = tokens->lines[match + i] + lineDelta;
+        }
+        stream->count += copied;
+
+        if (jobs[k].last) {
+            return;
+        }
+        scanner.current = source + jobs[k].stop;
+        scanner.line = jobs[k].stopLine + lineDelta;
+        token = scanToken(&scanner);
+    }
+
+    // Only reached if the last job never lined up, which cannot happen since
+    // both scans end with the same EOF; finish sequentially regardless.
+    for (;;) {
+        appendToken(stream, &scanner, token, 0);
+        if (token.type == TOKEN_EOF) {
+            return;
+        }
+        token = scanToken(&scanner);
+    }
+}
+
+bool tokenize(TokenStream* stream, const char* source, size_t length, int threads)
+{
+    initTokenStream(stream, source);
+    if (length >= UINT32_MAX) {
+        return false;
+    }
+
+    size_t most = length / TOKENIZE_PARALLEL_MIN;
+    int jobCount = threads < 1 ? 1 : threads;
+    if ((size_t)jobCount > most) {
+        jobCount = most < 1 ? 1 : (int)most;
+    }
+
+    TokenizeJob* jobs = ALLOCATE(&systemHeap, TokenizeJob, jobCount);
+    size_t start = 0;
+    int count = 0;
+    for (int k = 0; k < jobCount && start < length; k++) {
+        // Cut just after a newline: never inside a comment or a token other
+        // than a multi-line string.
+        size_t end = length;
+        if (k < jobCount - 1) {
+            const char* newline = memchr(source + length / jobCount * (k + 1), '\n',
+                length - length / jobCount * (k + 1));
+            end = newline == NULL ? length : (size_t)(newline + 1 - source);
+            if (end < start) {
+                continue;
+            }
+        }
+        jobs[count] = (TokenizeJob) {
+            .source = source,
+            .start = start,
+            .end = end,
+            .last = false,
+        };
+        initTokenStream(&jobs[count].tokens, source);
+        count++;
+        start = end;
+    }
+    if (count == 0) {
+        jobs[count] = (TokenizeJob) { .source = source, .start = 0, .end = length };
+        initTokenStream(&jobs[count].tokens, source);
+        count++;
+    }
+    jobs[count - 1].last = true;
+
+    if (count == 1) {
+        // Nothing to stitch: the single job scans the whole source.
+        runJob(&jobs[0]);
+        *stream = jobs[0].tokens;
+        FREE_ARRAY(&systemHeap, TokenizeJob, jobs, jobCount);
+        return true;
+    }
+
+    pthread_t* workers = ALLOCATE(&systemHeap, pthread_t, count);
+    int started = 0;
+    for (int k = 1; k < count; k++) {
+        if (pthread_create(&workers[k], NULL, runJob, &jobs[k]) != 0) {
+            break;
+        }
+        started = k;
+    }
+    runJob(&jobs[0]);
+    for (int k = 1; k <= started; k++) {
+        pthread_join(workers[k], NULL);
+    }
+    for (int k = started + 1; k < count; k++) {
+        runJob(&jobs[k]);
+    }
+    FREE_ARRAY(&systemHeap, pthread_t, workers, count);
+
+    mergeJobs(stream, jobs, count);
+    for (int k = 0; k < count; k++) {
+        freeTokenStream(&jobs[k].tokens);
+    }
+    FREE_ARRAY(&systemHeap, TokenizeJob, jobs, jobCount);
+    return true;
+}
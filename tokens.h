@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "allocator.h"
+#include "common.h"
+#include "scanner.h"
+
+// Below this many bytes per thread, tokenizing in parallel is not worth the
+// thread start-up.
+#define TOKENIZE_PARALLEL_MIN (1 << 20)
+
+// A whole source buffer tokenized up front, stored as parallel arrays so the
+// parser streams through a few bytes per token. Offsets are relative to
+// `source`, which must outlive the stream. Streams are scratch space and are
+// allocated from systemHeap.
+typedef struct {
+    const char* source;
+    int count;
+    int capacity;
+    uint8_t* types;
+    uint32_t* offsets;
+    uint32_t* lengths;
+    uint32_t* lines;
+} TokenStream;
+
+void initTokenStream(TokenStream* stream, const char* source);
+void freeTokenStream(TokenStream* stream);
+// Tokenizes `length` bytes of NUL-terminated `source` using up to `threads`
+// threads. The stream always ends with TOKEN_EOF and matches what repeated
+// scanToken() calls would return. Fails only if the source is too long for
+// 32-bit offsets.
+bool tokenize(TokenStream* stream, const char* source, size_t length, int threads);
+Token tokenAt(TokenStream* stream, int index);
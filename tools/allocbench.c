@@ -0,0 +1,201 @@
+// Counts the allocations a VM makes to evaluate a script: once cold, which
+// compiles it and fills the chunk cache, and then per evaluation once the
+// chunk is cached. Allocations are calls to the VM's allocator, including
+// reallocations that grow a block.
+//
+//   allocbench [file or directory]...
+//
+// Program output and any bytecode dumps go to /dev/null.
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../vm.h"
+
+#define RUNS 1000
+
+typedef struct {
+    size_t allocations;
+    size_t bytes;
+} Counts;
+
+static Counts counts;
+
+static void* countedAllocate(void* userData, size_t size)
+{
+    (void)userData;
+    counts.allocations++;
+    counts.bytes += size;
+    return malloc(size);
+}
+
+static void* countedReallocate(void* userData, void* pointer, size_t oldSize, size_t newSize)
+{
+    (void)userData;
+    if (newSize > oldSize) {
+        counts.allocations++;
+        counts.bytes += newSize;
+    }
+    return realloc(pointer, newSize);
+}
+
+static void countedFree(void* userData, void* pointer, size_t size)
+{
+    (void)userData;
+    (void)size;
+    free(pointer);
+}
+
+static const Allocator countingAllocator = {
+    .allocate = countedAllocate,
+    .reallocate = countedReallocate,
+    .free = countedFree,
+    .userData = NULL,
+};
+
+static FILE* report;
+
+static void discardOutput(void* userData, const char* bytes, size_t length)
+{
+    (void)userData;
+    (void)bytes;
+    (void)length;
+}
+
+static void silence(void)
+{
+    report = stdout;
+    int copy = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    if (copy >= 0 && null >= 0) {
+        report = fdopen(copy, "w");
+        setvbuf(report, NULL, _IOLBF, 0);
+        fflush(stdout);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        close(null);
+    }
+}
+
+static char* readFile(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    fseek(file, 0L, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+    char* source = size < 0 ? NULL : malloc((size_t)size + 1);
+    if (source != NULL) {
+        size_t read = fread(source, 1, (size_t)size, file);
+        source[read] = '\0';
+    }
+    fclose(file);
+    return source;
+}
+
+static bool benchFile(const char* path)
+{
+    char* source = readFile(path);
+    if (source == NULL) {
+        fprintf(report, "allocbench: cannot read %s\n", path);
+        return false;
+    }
+
+    VM vm;
+    initVMWithAllocator(&vm, &countingAllocator);
+    outputToCallback(&vm.out, discardOutput, NULL);
+
+    counts = (Counts) { 0, 0 };
+    bool ok = interpret(&vm, source) == INTERPRET_OK;
+    Counts cold = counts;
+    counts = (Counts) { 0, 0 };
+    for (int run = 0; ok && run < RUNS; run++) {
+        ok = interpret(&vm, source) == INTERPRET_OK;
+    }
+    Counts cached = counts;
+    freeVM(&vm);
+
+    if (ok) {
+        fprintf(report, "%-36s %8zu %10zu %10.2f %10.1f\n", path, cold.allocations, cold.bytes,
+            (double)cached.allocations / RUNS, (double)cached.bytes / RUNS);
+    } else {
+        fprintf(report, "allocbench: %s does not run\n", path);
+    }
+    free(source);
+    return ok;
+}
+
+static int compareNames(const void* a, const void* b)
+{
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// Benchmarks every .lox file in the directory, in name order.
+static bool benchDirectory(const char* path)
+{
+    DIR* directory = opendir(path);
+    if (directory == NULL) {
+        fprintf(report, "allocbench: cannot open %s\n", path);
+        return false;
+    }
+    char** names = NULL;
+    int count = 0;
+    int capacity = 0;
+    struct dirent* entry;
+    while ((entry = readdir(directory)) != NULL) {
+        size_t length = strlen(entry->d_name);
+        if (entry->d_name[0] == '.' || length < 4 || strcmp(entry->d_name + length - 4, ".lox") != 0) {
+            continue;
+        }
+        if (count == capacity) {
+            capacity = capacity < 8 ? 8 : capacity * 2;
+            names = realloc(names, capacity * sizeof(char*));
+        }
+        if (asprintf(&names[count], "%s/%s", path, entry->d_name) < 0) {
+            abort();
+        }
+        count++;
+    }
+    closedir(directory);
+
+    qsort(names, count, sizeof(char*), compareNames);
+    bool ok = true;
+    for (int i = 0; i < count; i++) {
+        ok = benchFile(names[i]) && ok;
+        free(names[i]);
+    }
+    free(names);
+    return ok;
+}
+
+int main(int argc, const char* argv[])
+{
+    if (argc == 1) {
+        fprintf(stderr, "Usage: allocbench [file or directory]...\n");
+        return 64;
+    }
+    silence();
+
+    fprintf(report, "%-36s %8s %10s %10s %10s\n", "input", "cold", "bytes", "cached", "bytes");
+    bool ok = true;
+    for (int i = 1; i < argc; i++) {
+        struct stat info;
+        if (stat(argv[i], &info) == 0 && S_ISDIR(info.st_mode)) {
+            ok = benchDirectory(argv[i]) && ok;
+        } else {
+            ok = benchFile(argv[i]) && ok;
+        }
+    }
+    return ok ? 0 : 1;
+}
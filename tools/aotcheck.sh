@@ -0,0 +1,63 @@
+#!/bin/sh
+# Differential check of `clox --emit-c` against the interpreter: every .lox
+# file under the given directories is run by ./program and translated to C,
+# which must compile with -Wall -Werror against libclox.a and then print the
+# same output, report the same errors and exit with the same status.
+#
+#   tools/aotcheck.sh tools/aot-corpus
+#
+# Run from the repository root after `make program libclox.a`. The
+# interpreter may disassemble what it compiles (DEBUG_PRINT_CODE); that part
+# of its output is left out of the comparison.
+
+CC=${CC:-gcc}
+work=$(mktemp -d) || exit 1
+trap 'rm -rf "$work"' EXIT
+
+failures=0
+for file in $(find "$@" -name '*.lox' | sort); do
+    ./program "$file" > "$work/expected.out" 2> "$work/expected.err"
+    expected=$?
+    sed -i '/^== .* == $/,/^== end == $/d' "$work/expected.out"
+
+    if ! ./program --emit-c "$work/script.c" "$file" > /dev/null 2> "$work/emit.err"; then
+        # A script that does not compile has nothing to translate.
+        if [ "$expected" -eq 65 ]; then
+            echo "ok   $file (compile error)"
+        else
+            echo "FAIL $file: --emit-c failed"
+            cat "$work/emit.err"
+            failures=$((failures + 1))
+        fi
+        continue
+    fi
+    if ! $CC -std=c99 -Wall -Werror -O1 -I. "$work/script.c" libclox.a -lm -pthread \
+        -o "$work/script" 2> "$work/cc.err"; then
+        echo "FAIL $file: generated C does not compile"
+        cat "$work/cc.err"
+        failures=$((failures + 1))
+        continue
+    fi
+
+    "$work/script" > "$work/actual.out" 2> "$work/actual.err"
+    actual=$?
+    if [ "$actual" -ne "$expected" ]; then
+        echo "FAIL $file: exit status $actual, interpreter $expected"
+        failures=$((failures + 1))
+    elif ! cmp -s "$work/expected.out" "$work/actual.out"; then
+        echo "FAIL $file: stdout differs"
+        diff "$work/expected.out" "$work/actual.out"
+        failures=$((failures + 1))
+    elif ! cmp -s "$work/expected.err" "$work/actual.err"; then
+        echo "FAIL $file: stderr differs"
+        diff "$work/expected.err" "$work/actual.err"
+        failures=$((failures + 1))
+    else
+        echo "ok   $file"
+    fi
+done
+
+if [ "$failures" -gt 0 ]; then
+    echo "aotcheck: $failures script(s) differ"
+    exit 1
+fi
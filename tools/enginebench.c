@@ -0,0 +1,227 @@
+// Side-by-side timing of the stack and register engines. Each input is
+// compiled once and then evaluated over and over from the chunk cache on
+// each engine, so what is measured is running the chunk, not compiling it.
+//
+//   enginebench [file or directory]...
+//
+// For every input it prints the instructions each engine executes per
+// evaluation (bytecode has no jumps, so that is the length of the chunk) and
+// the cheapest mean time per evaluation over ROUNDS rounds of RUNS. Program
+// output and any bytecode dumps go to /dev/null.
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../compiler.h"
+#include "../regchunk.h"
+#include "../vm.h"
+
+#define RUNS 2000
+#define ROUNDS 7
+
+static FILE* report;
+
+static uint64_t nowNanos(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static void discardOutput(void* userData, const char* bytes, size_t length)
+{
+    (void)userData;
+    (void)bytes;
+    (void)length;
+}
+
+static void silence(void)
+{
+    report = stdout;
+    int copy = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    if (copy >= 0 && null >= 0) {
+        report = fdopen(copy, "w");
+        setvbuf(report, NULL, _IOLBF, 0);
+        fflush(stdout);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        close(null);
+    }
+}
+
+static int stackInstructions(Chunk* chunk)
+{
+    int count = 0;
+    for (int offset = 0; offset < chunk->count; offset += 1 + opInfo[chunk->code[offset]].operandBytes) {
+        count++;
+    }
+    return count;
+}
+
+// Instructions per evaluation on each engine, or false if the source does
+// not compile or the register engine cannot take it.
+static bool countInstructions(const char* source, int* stack, int* registers)
+{
+    VM vm;
+    initVM(&vm);
+    Chunk chunk;
+    initChunk(&chunk, &vm.heap);
+    RegChunk translated;
+    initRegChunk(&translated, &vm.heap);
+
+    bool ok = compile(&vm, source, &chunk) && translateChunk(&chunk, &translated);
+    if (ok) {
+        *stack = stackInstructions(&chunk);
+        *registers = translated.count;
+    }
+    freeRegChunk(&translated);
+    freeChunk(&chunk);
+    freeVM(&vm);
+    return ok;
+}
+
+// Nanoseconds per evaluation on one engine, or 0 if the source fails. The
+// first evaluation compiles, caches and, on the register engine,
+// translates; it is not timed.
+static double timeEngine(const char* source, bool registers)
+{
+    VM vm;
+    initVM(&vm);
+    outputToCallback(&vm.out, discardOutput, NULL);
+    vm.useRegisters = registers;
+
+    double best = 0;
+    if (interpret(&vm, source) == INTERPRET_OK) {
+        for (int round = 0; round < ROUNDS; round++) {
+            uint64_t start = nowNanos();
+            for (int run = 0; run < RUNS; run++) {
+                interpret(&vm, source);
+            }
+            double mean = (double)(nowNanos() - start) / RUNS;
+            if (round == 0 || mean < best) {
+                best = mean;
+            }
+        }
+    }
+    freeVM(&vm);
+    return best;
+}
+
+static char* readFile(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    fseek(file, 0L, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+    char* source = size < 0 ? NULL : malloc((size_t)size + 1);
+    if (source != NULL) {
+        size_t read = fread(source, 1, (size_t)size, file);
+        source[read] = '\0';
+    }
+    fclose(file);
+    return source;
+}
+
+static bool benchFile(const char* path)
+{
+    char* source = readFile(path);
+    if (source == NULL) {
+        fprintf(report, "enginebench: cannot read %s\n", path);
+        return false;
+    }
+
+    int stack;
+    int registers;
+    double stackNanos = 0;
+    double registerNanos = 0;
+    bool ok = countInstructions(source, &stack, &registers)
+        && (stackNanos = timeEngine(source, false)) > 0
+        && (registerNanos = timeEngine(source, true)) > 0;
+    if (ok) {
+        fprintf(report, "%-36s %8d %10.0f %8d %10.0f %7.2fx\n", path, stack, stackNanos, registers,
+            registerNanos, stackNanos / registerNanos);
+    } else {
+        fprintf(report, "enginebench: %s does not run on both engines\n", path);
+    }
+    free(source);
+    return ok;
+}
+
+static int compareNames(const void* a, const void* b)
+{
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// Benchmarks every .lox file in the directory, in name order.
+static bool benchDirectory(const char* path)
+{
+    DIR* directory = opendir(path);
+    if (directory == NULL) {
+        fprintf(report, "enginebench: cannot open %s\n", path);
+        return false;
+    }
+    char** names = NULL;
+    int count = 0;
+    int capacity = 0;
+    struct dirent* entry;
+    while ((entry = readdir(directory)) != NULL) {
+        size_t length = strlen(entry->d_name);
+        if (entry->d_name[0] == '.' || length < 4 || strcmp(entry->d_name + length - 4, ".lox") != 0) {
+            continue;
+        }
+        if (count == capacity) {
+            capacity = capacity < 8 ? 8 : capacity * 2;
+            names = realloc(names, capacity * sizeof(char*));
+        }
+        if (asprintf(&names[count], "%s/%s", path, entry->d_name) < 0) {
+            abort();
+        }
+        count++;
+    }
+    closedir(directory);
+
+    qsort(names, count, sizeof(char*), compareNames);
+    bool ok = true;
+    for (int i = 0; i < count; i++) {
+        ok = benchFile(names[i]) && ok;
+        free(names[i]);
+    }
+    free(names);
+    return ok;
+}
+
+int main(int argc, const char* argv[])
+{
+    if (argc == 1) {
+        fprintf(stderr, "Usage: enginebench [file or directory]...\n");
+        return 64;
+    }
+    silence();
+
+    fprintf(report, "%-36s %8s %10s %8s %10s %8s\n", "input", "stack", "ns", "register", "ns",
+        "speedup");
+    bool ok = true;
+    for (int i = 1; i < argc; i++) {
+        struct stat info;
+        if (stat(argv[i], &info) == 0 && S_ISDIR(info.st_mode)) {
+            ok = benchDirectory(argv[i]) && ok;
+        } else {
+            ok = benchFile(argv[i]) && ok;
+        }
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,266 @@
+// Load generator for `clox --serve`. Opens one connection per thread, keeps
+// `depth` requests in flight on each and reports throughput and latency.
+//
+//   loadgen [-c connections] [-n requests] [-d depth] [--chunk] socket file
+//
+// With --chunk, `file` is a chunk image written by `clox --compile`.
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../server.h"
+
+typedef struct {
+    const char* socketPath;
+    const uint8_t* request; // one complete framed request
+    size_t requestLength;
+    long count;
+    int depth;
+    uint64_t* latencies; // nanoseconds, one per request
+    long failures; // responses with a non-zero status
+    bool ok;
+} Worker;
+
+static uint64_t nowNanos(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static bool sendAll(int fd, const uint8_t* bytes, size_t length)
+{
+    while (length > 0) {
+        ssize_t sent = send(fd, bytes, length, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        bytes += sent;
+        length -= (size_t)sent;
+    }
+    return true;
+}
+
+static bool receiveAll(int fd, uint8_t* bytes, size_t length)
+{
+    while (length > 0) {
+        ssize_t received = recv(fd, bytes, length, 0);
+        if (received <= 0) {
+            if (received < 0 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        bytes += received;
+        length -= (size_t)received;
+    }
+    return true;
+}
+
+// Reads one response and discards its payload. Returns its status, or -1.
+static int receiveResponse(int fd)
+{
+    uint8_t header[SERVE_HEADER_SIZE];
+    if (!receiveAll(fd, header, sizeof(header))) {
+        return -1;
+    }
+    uint32_t length = 0;
+    for (int i = 0; i < 4; i++) {
+        length |= (uint32_t)header[1 + i] << (8 * i);
+    }
+    uint8_t discard[4096];
+    while (length > 0) {
+        size_t chunk = length < sizeof(discard) ? length : sizeof(discard);
+        if (!receiveAll(fd, discard, chunk)) {
+            return -1;
+        }
+        length -= (uint32_t)chunk;
+    }
+    return header[0];
+}
+
+static int connectTo(const char* path)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+static void* runWorker(void* argument)
+{
+    Worker* worker = argument;
+    int fd = connectTo(worker->socketPath);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    // Responses come back in order, so a ring of send times is enough to
+    // match them up.
+    uint64_t* sentAt = calloc(worker->depth, sizeof(uint64_t));
+    long sent = 0;
+    long received = 0;
+    while (received < worker->count) {
+        while (sent < worker->count && sent - received < worker->depth) {
+            sentAt[sent % worker->depth] = nowNanos();
+            if (!sendAll(fd, worker->request, worker->requestLength)) {
+                goto done;
+            }
+            sent++;
+        }
+        int status = receiveResponse(fd);
+        if (status < 0) {
+            goto done;
+        }
+        if (status != 0) {
+            worker->failures++;
+        }
+        worker->latencies[received] = nowNanos() - sentAt[received % worker->depth];
+        received++;
+    }
+    worker->ok = true;
+
+done:
+    free(sentAt);
+    close(fd);
+    return NULL;
+}
+
+static int compareNanos(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static uint8_t* readFile(const char* path, size_t* length)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    fseek(file, 0L, SEEK_END);
+    *length = (size_t)ftell(file);
+    rewind(file);
+    uint8_t* bytes = malloc(*length + SERVE_HEADER_SIZE);
+    if (bytes == NULL || fread(bytes + SERVE_HEADER_SIZE, 1, *length, file) != *length) {
+        free(bytes);
+        bytes = NULL;
+    }
+    fclose(file);
+    return bytes;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: loadgen [-c connections] [-n requests] [-d depth] [--chunk] socket file\n");
+    exit(64);
+}
+
+int main(int argc, const char* argv[])
+{
+    int connections = 4;
+    long requests = 100000;
+    int depth = 1;
+    ServeRequestKind kind = SERVE_SOURCE;
+
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "-c") == 0 && arg + 1 < argc) {
+            connections = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "-n") == 0 && arg + 1 < argc) {
+            requests = atol(argv[++arg]);
+        } else if (strcmp(argv[arg], "-d") == 0 && arg + 1 < argc) {
+            depth = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "--chunk") == 0) {
+            kind = SERVE_CHUNK;
+        } else {
+            usage();
+        }
+    }
+    if (arg + 2 != argc || connections < 1 || requests < connections || depth < 1) {
+        usage();
+    }
+
+    size_t length;
+    uint8_t* request = readFile(argv[arg + 1], &length);
+    if (request == NULL) {
+        fprintf(stderr, "Could not read \"%s\".\n", argv[arg + 1]);
+        return 74;
+    }
+    request[0] = (uint8_t)kind;
+    for (int i = 0; i < 4; i++) {
+        request[1 + i] = (uint8_t)(length >> (8 * i));
+    }
+
+    long perWorker = requests / connections;
+    Worker* workers = calloc(connections, sizeof(Worker));
+    pthread_t* threads = calloc(connections, sizeof(pthread_t));
+    uint64_t* latencies = calloc(perWorker * connections, sizeof(uint64_t));
+
+    uint64_t start = nowNanos();
+    for (int i = 0; i < connections; i++) {
+        workers[i] = (Worker) {
+            .socketPath = argv[arg],
+            .request = request,
+            .requestLength = length + SERVE_HEADER_SIZE,
+            .count = perWorker,
+            .depth = depth,
+            .latencies = latencies + perWorker * i,
+        };
+        pthread_create(&threads[i], NULL, runWorker, &workers[i]);
+    }
+    long failures = 0;
+    bool ok = true;
+    for (int i = 0; i < connections; i++) {
+        pthread_join(threads[i], NULL);
+        failures += workers[i].failures;
+        ok = ok && workers[i].ok;
+    }
+    double seconds = (double)(nowNanos() - start) / 1e9;
+
+    if (!ok) {
+        fprintf(stderr, "A connection failed before finishing its requests.\n");
+        return 70;
+    }
+
+    long total = perWorker * connections;
+    qsort(latencies, total, sizeof(uint64_t), compareNanos);
+    printf("%ld requests over %d connections (depth %d) in %.3f s: %.0f requests/s\n",
+        total, connections, depth, seconds, (double)total / seconds);
+    printf("latency us: p50 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+        latencies[total / 2] / 1e3, latencies[total * 99 / 100] / 1e3,
+        latencies[total * 999 / 1000] / 1e3, latencies[total - 1] / 1e3);
+    if (failures > 0) {
+        printf("%ld requests failed\n", failures);
+    }
+
+    free(latencies);
+    free(threads);
+    free(workers);
+    free(request);
+    return 0;
+}
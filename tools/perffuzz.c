@@ -0,0 +1,405 @@
+// Performance fuzzing for the scanner, the compiler and the VM. Each input is
+// scanned, compiled and interpreted on both engines while the time taken and
+// the bytes allocated are measured, and every phase has to stay within a
+// budget proportional to the length of the input. Anything super-linear in
+// the input shows up as a phase that blows its budget.
+//
+//   perfcheck [file or directory]...
+//
+// Replays the inputs, reporting the worst phase of each, and fails if any of
+// them is over budget. Without arguments it checks one input from stdin and
+// aborts if it is over, which is what AFL expects of a target built with
+// afl-clang-fast. Built with -DCLOX_LIBFUZZER and clang -fsanitize=fuzzer
+// (`make perffuzz`), the same checks form a libFuzzer target; run it with
+// -close_fd_mask=3 to keep the interpreter's output out of the log. A
+// violation aborts, so the fuzzer saves the input as a crash;
+// -minimize_crash=1 or afl-tmin shrinks it, and the result belongs in
+// tools/perf-corpus/, which `make perfcheck` replays.
+//
+// A phase may take BASE_NANOS plus CLOX_PERF_NS_PER_BYTE (default 2000)
+// nanoseconds per input byte, and allocate BASE_BYTES plus
+// CLOX_PERF_BYTES_PER_BYTE (default 256) bytes per input byte. The
+// interpreting phases run with twice that as the VM's memory limit, so an
+// input cannot take the machine down before it is reported. Inputs that are
+// expensive by the language's own rules, such as a string doubled over and
+// over, are reported like any other: a host's defense against those is its
+// memory limit, and they do not belong in the corpus.
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../compiler.h"
+#include "../memory.h"
+#include "../scanner.h"
+#include "../vm.h"
+
+// What every phase may spend regardless of the input: creating the VM's
+// buffers, the first scratch block, cold caches.
+#define BASE_NANOS 5000000
+#define BASE_BYTES (1 << 20)
+
+// A phase over budget is measured this many times, and only the cheapest
+// run counts, so that a preempted run is not reported.
+#define ATTEMPTS 5
+
+typedef enum {
+    PHASE_SCAN,
+    PHASE_COMPILE,
+    PHASE_STACK,
+    PHASE_REGISTERS,
+    PHASE_COUNT
+} Phase;
+
+static const char* phaseNames[PHASE_COUNT] = {
+    [PHASE_SCAN] = "scan",
+    [PHASE_COMPILE] = "compile",
+    [PHASE_STACK] = "interpret",
+    [PHASE_REGISTERS] = "interpret --registers",
+};
+
+typedef struct {
+    uint64_t nanos;
+    size_t bytes;
+} Cost;
+
+static uint64_t nanosPerByte = 2000;
+static size_t bytesPerByte = 256;
+
+// Bytes handed out so far by countingAllocator. A reallocation counts as
+// much as a fresh allocation of the new size, so that growing one byte at a
+// time is as visible as it is slow. The tokenizer's threads allocate too.
+static size_t allocated;
+
+static void* countedAllocate(void* userData, size_t size)
+{
+    (void)userData;
+    __atomic_add_fetch(&allocated, size, __ATOMIC_RELAXED);
+    return malloc(size);
+}
+
+static void* countedReallocate(void* userData, void* pointer, size_t oldSize, size_t newSize)
+{
+    (void)userData;
+    if (newSize > oldSize) {
+        __atomic_add_fetch(&allocated, newSize, __ATOMIC_RELAXED);
+    }
+    return realloc(pointer, newSize);
+}
+
+static void countedFree(void* userData, void* pointer, size_t size)
+{
+    (void)userData;
+    (void)size;
+    free(pointer);
+}
+
+static const Allocator countingAllocator = {
+    .allocate = countedAllocate,
+    .reallocate = countedReallocate,
+    .free = countedFree,
+    .userData = NULL,
+};
+
+static uint64_t nowNanos(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static size_t readSetting(const char* name, size_t fallback)
+{
+    const char* setting = getenv(name);
+    if (setting == NULL || *setting == '\0') {
+        return fallback;
+    }
+    char* end;
+    unsigned long long value = strtoull(setting, &end, 10);
+    if (*end != '\0' || value == 0) {
+        fprintf(stderr, "perfcheck: ignoring %s=%s\n", name, setting);
+        return fallback;
+    }
+    return (size_t)value;
+}
+
+// The interpreter reports errors on stderr and the compiler may dump
+// bytecode on stdout; neither is of interest here, so both go to /dev/null
+// and the harness reports on a copy of stderr.
+static FILE* report;
+
+static void setUp(bool silence)
+{
+    nanosPerByte = readSetting("CLOX_PERF_NS_PER_BYTE", nanosPerByte);
+    bytesPerByte = readSetting("CLOX_PERF_BYTES_PER_BYTE", bytesPerByte);
+    systemHeap.allocator = countingAllocator;
+
+    report = stderr;
+    if (silence) {
+        int copy = dup(STDERR_FILENO);
+        int null = open("/dev/null", O_WRONLY);
+        if (copy >= 0 && null >= 0) {
+            report = fdopen(copy, "w");
+            setvbuf(report, NULL, _IOLBF, 0);
+            fflush(stdout);
+            dup2(null, STDOUT_FILENO);
+            dup2(null, STDERR_FILENO);
+            close(null);
+        }
+    }
+}
+
+static Cost budgetFor(size_t length)
+{
+    return (Cost) {
+        .nanos = BASE_NANOS + nanosPerByte * length,
+        .bytes = BASE_BYTES + bytesPerByte * length,
+    };
+}
+
+// Runs one phase on a VM of its own. Setting the VM up and tearing it down
+// are not measured.
+static Cost measure(Phase phase, const char* source, size_t byteBudget)
+{
+    VM vm;
+    initVMWithAllocator(&vm, &countingAllocator);
+    outputToMemory(&vm.out);
+    vm.useRegisters = phase == PHASE_REGISTERS;
+    setMemoryLimit(&vm, vm.heap.bytes + 2 * byteBudget);
+    Chunk chunk;
+    initChunk(&chunk, &vm.heap);
+
+    size_t before = __atomic_load_n(&allocated, __ATOMIC_RELAXED);
+    uint64_t start = nowNanos();
+    switch (phase) {
+    case PHASE_SCAN: {
+        Scanner scanner;
+        initScanner(&scanner, source);
+        while (scanToken(&scanner).type != TOKEN_EOF)
+            ;
+        break;
+    }
+    case PHASE_COMPILE:
+        compile(&vm, source, &chunk);
+        break;
+    case PHASE_STACK:
+    case PHASE_REGISTERS:
+        interpret(&vm, source);
+        flushOutput(&vm.out);
+        break;
+    default:
+        break;
+    }
+    Cost cost = {
+        .nanos = nowNanos() - start,
+        .bytes = __atomic_load_n(&allocated, __ATOMIC_RELAXED) - before,
+    };
+
+    freeChunk(&chunk);
+    freeVM(&vm);
+    return cost;
+}
+
+static bool withinBudget(Cost cost, Cost budget)
+{
+    return cost.nanos <= budget.nanos && cost.bytes <= budget.bytes;
+}
+
+// Checks every phase; on a violation, describes it on the report stream
+// with `name` identifying the input. Otherwise stores the phase that came
+// closest to its budget, as a percentage of it, in *worst.
+static bool checkSource(const char* name, const char* source, int* worst)
+{
+    size_t length = strlen(source);
+    Cost budget = budgetFor(length);
+    bool ok = true;
+    *worst = 0;
+
+    for (Phase phase = 0; phase < PHASE_COUNT; phase++) {
+        Cost cost = measure(phase, source, budget.bytes);
+        for (int attempt = 1; attempt < ATTEMPTS && !withinBudget(cost, budget); attempt++) {
+            Cost again = measure(phase, source, budget.bytes);
+            if (again.nanos < cost.nanos) {
+                cost.nanos = again.nanos;
+            }
+            if (again.bytes < cost.bytes) {
+                cost.bytes = again.bytes;
+            }
+        }
+
+        if (!withinBudget(cost, budget)) {
+            fprintf(report,
+                "perfcheck: %s: %s of %zu bytes took %.3f ms (budget %.3f ms) "
+                "and allocated %zu bytes (budget %zu)\n",
+                name, phaseNames[phase], length, cost.nanos / 1e6, budget.nanos / 1e6,
+                cost.bytes, budget.bytes);
+            ok = false;
+        }
+        int timeShare = (int)(cost.nanos * 100 / budget.nanos);
+        int byteShare = (int)(cost.bytes * 100 / budget.bytes);
+        int share = timeShare > byteShare ? timeShare : byteShare;
+        if (share > *worst) {
+            *worst = share;
+        }
+    }
+    return ok;
+}
+
+// The inputs are C strings to the interpreter, so a NUL ends them.
+static char* copySource(const uint8_t* data, size_t size)
+{
+    char* source = malloc(size + 1);
+    if (source == NULL) {
+        abort();
+    }
+    memcpy(source, data, size);
+    source[size] = '\0';
+    return source;
+}
+
+#ifdef CLOX_LIBFUZZER
+
+int LLVMFuzzerInitialize(int* argc, char*** argv)
+{
+    setUp(false);
+    return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    char* source = copySource(data, size);
+    int worst;
+    if (!checkSource("input", source, &worst)) {
+        abort();
+    }
+    free(source);
+    return 0;
+}
+
+#else
+
+static char* readAll(FILE* file)
+{
+    size_t capacity = 4096;
+    size_t length = 0;
+    uint8_t* data = malloc(capacity);
+    size_t count;
+    while (data != NULL && (count = fread(data + length, 1, capacity - length, file)) > 0) {
+        length += count;
+        if (length == capacity) {
+            capacity *= 2;
+            data = realloc(data, capacity);
+        }
+    }
+    if (data == NULL) {
+        return NULL;
+    }
+    char* source = copySource(data, length);
+    free(data);
+    return source;
+}
+
+static bool replayFile(const char* path, int* failures)
+{
+    FILE* file = fopen(path, "rb");
+    char* source = file == NULL ? NULL : readAll(file);
+    if (file != NULL) {
+        fclose(file);
+    }
+    if (source == NULL) {
+        fprintf(report, "perfcheck: cannot read %s\n", path);
+        return false;
+    }
+
+    int worst;
+    bool ok = checkSource(path, source, &worst);
+    fprintf(report, "%-4s %s (%zu bytes, %d%% of budget)\n", ok ? "ok" : "FAIL", path,
+        strlen(source), worst);
+    if (!ok) {
+        (*failures)++;
+    }
+    free(source);
+    return true;
+}
+
+static int compareNames(const void* a, const void* b)
+{
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// Replays every file in the directory, in name order.
+static bool replayDirectory(const char* path, int* failures)
+{
+    DIR* directory = opendir(path);
+    if (directory == NULL) {
+        return false;
+    }
+    char** names = NULL;
+    int count = 0;
+    int capacity = 0;
+    struct dirent* entry;
+    while ((entry = readdir(directory)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        if (count == capacity) {
+            capacity = capacity < 8 ? 8 : capacity * 2;
+            names = realloc(names, capacity * sizeof(char*));
+        }
+        if (asprintf(&names[count], "%s/%s", path, entry->d_name) < 0) {
+            abort();
+        }
+        count++;
+    }
+    closedir(directory);
+
+    qsort(names, count, sizeof(char*), compareNames);
+    bool ok = true;
+    for (int i = 0; i < count; i++) {
+        ok = replayFile(names[i], failures) && ok;
+        free(names[i]);
+    }
+    free(names);
+    return ok;
+}
+
+int main(int argc, const char* argv[])
+{
+    setUp(true);
+
+    if (argc == 1) {
+        char* source = readAll(stdin);
+        int worst;
+        if (source == NULL || !checkSource("stdin", source, &worst)) {
+            abort();
+        }
+        free(source);
+        return 0;
+    }
+
+    int failures = 0;
+    bool readable = true;
+    for (int i = 1; i < argc; i++) {
+        struct stat info;
+        if (stat(argv[i], &info) == 0 && S_ISDIR(info.st_mode)) {
+            readable = replayDirectory(argv[i], &failures) && readable;
+        } else {
+            readable = replayFile(argv[i], &failures) && readable;
+        }
+    }
+    if (failures > 0) {
+        fprintf(report, "perfcheck: %d input%s over budget\n", failures, failures == 1 ? "" : "s");
+    }
+    return failures > 0 || !readable ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,64 @@
+// Writes a machine-generated expression of about a million tokens in one of
+// the shapes that used to overflow the native stack of the recursive parser:
+//
+//   stressgen negate|group|not|equal [tokens]
+//
+//   negate   -(-(-( ... 1 ... )))
+//   group    ((( ... 1 ... )))
+//   not      !!! ... true
+//   equal    (true == (true == ( ... true ... )))
+//
+// `make stress` feeds one of each to perfcheck, which fails if scanning,
+// compiling or running any of them is out of proportion to its length.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_TOKENS 1000000L
+
+static void repeat(const char* text, long count)
+{
+    for (long i = 0; i < count; i++) {
+        fputs(text, stdout);
+    }
+}
+
+int main(int argc, const char* argv[])
+{
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: stressgen negate|group|not|equal [tokens]\n");
+        return 64;
+    }
+    long tokens = argc == 3 ? strtol(argv[2], NULL, 10) : DEFAULT_TOKENS;
+    if (tokens <= 0) {
+        fprintf(stderr, "stressgen: bad token count \"%s\"\n", argv[2]);
+        return 64;
+    }
+
+    const char* shape = argv[1];
+    if (strcmp(shape, "negate") == 0) {
+        long depth = tokens / 3;
+        repeat("-(", depth);
+        fputs("1", stdout);
+        repeat(")", depth);
+    } else if (strcmp(shape, "group") == 0) {
+        long depth = tokens / 2;
+        repeat("(", depth);
+        fputs("1", stdout);
+        repeat(")", depth);
+    } else if (strcmp(shape, "not") == 0) {
+        repeat("!", tokens - 1);
+        fputs("true", stdout);
+    } else if (strcmp(shape, "equal") == 0) {
+        long depth = tokens / 4;
+        repeat("(true == ", depth);
+        fputs("true", stdout);
+        repeat(")", depth);
+    } else {
+        fprintf(stderr, "stressgen: unknown shape \"%s\"\n", shape);
+        return 64;
+    }
+    fputs("\n", stdout);
+    return 0;
+}
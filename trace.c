@@ -0,0 +1,187 @@
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <time.h>
+
+#include "debug.h"
+#include "memory.h"
+#include "trace.h"
+
+#define TRACE_MAGIC "CLXT"
+#define TRACE_VERSION 1
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t count;
+    uint32_t eventSize;
+} TraceHeader;
+
+static uint64_t nowNanos(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+void initTracer(Tracer* tracer, Heap* heap)
+{
+    *tracer = (Tracer) {
+        .heap = heap,
+        .enabled = false,
+        .timestamps = false,
+        .capacity = 0,
+        .events = NULL,
+        .head = 0,
+    };
+}
+
+void freeTracer(Tracer* tracer)
+{
+    FREE_ARRAY(tracer->heap, TraceEvent, tracer->events, tracer->capacity);
+    initTracer(tracer, tracer->heap);
+}
+
+void enableTracing(Tracer* tracer, uint32_t capacity, bool timestamps)
+{
+    uint32_t rounded = 1;
+    while (rounded < capacity) {
+        rounded <<= 1;
+    }
+
+    if (rounded != tracer->capacity) {
+        tracer->events = GROW_ARRAY(tracer->heap, tracer->events, TraceEvent, tracer->capacity, rounded);
+        tracer->capacity = rounded;
+    }
+    __atomic_store_n(&tracer->head, 0, __ATOMIC_RELEASE);
+    tracer->timestamps = timestamps;
+    tracer->enabled = true;
+}
+
+void disableTracing(Tracer* tracer)
+{
+    tracer->enabled = false;
+}
+
+void traceInstruction(Tracer* tracer, uint32_t offset, uint8_t opcode, int depth, int topType)
+{
+    uint64_t head = __atomic_load_n(&tracer->head, __ATOMIC_RELAXED);
+    // Keeps the writes below from becoming visible before the previous
+    // event's head; snapshotTrace() relies on that to spot reused slots.
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    TraceEvent* event = &tracer->events[head & (tracer->capacity - 1)];
+    event->timestamp = tracer->timestamps ? nowNanos() : 0;
+    event->offset = offset;
+    event->opcode = opcode;
+    event->topType = (uint8_t)topType;
+    event->depth = depth > UINT16_MAX ? UINT16_MAX : (uint16_t)depth;
+    __atomic_store_n(&tracer->head, head + 1, __ATOMIC_RELEASE);
+}
+
+uint32_t snapshotTrace(Tracer* tracer, TraceEvent* out, uint32_t max)
+{
+    if (tracer->capacity == 0) {
+        return 0;
+    }
+
+    uint64_t head = __atomic_load_n(&tracer->head, __ATOMIC_ACQUIRE);
+    uint64_t available = head < tracer->capacity ? head : tracer->capacity;
+    uint32_t count = available < max ? (uint32_t)available : max;
+    uint64_t first = head - count;
+
+    for (uint32_t i = 0; i < count; i++) {
+        out[i] = tracer->events[(first + i) & (tracer->capacity - 1)];
+    }
+
+    // The writer may have lapped us while we copied; drop the events whose
+    // slots were reused. Event `after` may be half written already, and its
+    // slot is the one event after - capacity had, so that one goes too.
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    uint64_t after = __atomic_load_n(&tracer->head, __ATOMIC_RELAXED);
+    uint64_t intact = after + 1 > tracer->capacity ? after + 1 - tracer->capacity : 0;
+    uint64_t overwritten = intact > first ? intact - first : 0;
+    if (overwritten >= count) {
+        return 0;
+    }
+    if (overwritten > 0) {
+        memmove(out, out + overwritten, (count - overwritten) * sizeof(TraceEvent));
+        count -= (uint32_t)overwritten;
+    }
+    return count;
+}
+
+bool writeTrace(Tracer* tracer, FILE* file)
+{
+    TraceEvent* events = ALLOCATE(tracer->heap, TraceEvent, tracer->capacity);
+    uint32_t count = snapshotTrace(tracer, events, tracer->capacity);
+
+    TraceHeader header = {
+        .magic = TRACE_MAGIC,
+        .version = TRACE_VERSION,
+        .count = count,
+        .eventSize = sizeof(TraceEvent),
+    };
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(events, sizeof(TraceEvent), count, file) == count;
+
+    FREE_ARRAY(tracer->heap, TraceEvent, events, tracer->capacity);
+    return ok;
+}
+
+static const char* typeName(uint8_t type)
+{
+    switch (type) {
+    case VAL_BOOL:
+        return "bool";
+    case VAL_NIL:
+        return "nil";
+    case VAL_NUMBER:
+        return "number";
+    case VAL_INT:
+        return "int";
+    case VAL_SHORT_STRING:
+        return "short string";
+    case VAL_OBJ:
+        return "obj";
+    case TRACE_EMPTY_STACK:
+        return "-";
+    default:
+        return "?";
+    }
+}
+
+bool decodeTrace(FILE* file, Chunk* chunk)
+{
+    TraceHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1
+        || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0
+        || header.version != TRACE_VERSION
+        || header.eventSize != sizeof(TraceEvent)) {
+        return false;
+    }
+
+    uint64_t start = 0;
+    for (uint32_t i = 0; i < header.count; i++) {
+        TraceEvent event;
+        if (fread(&event, sizeof(event), 1, file) != 1) {
+            return false;
+        }
+        if (i == 0) {
+            start = event.timestamp;
+        }
+
+        printf("%10llu depth %-5u top %-12s ",
+            (unsigned long long)(event.timestamp - start), event.depth, typeName(event.topType));
+        if (event.offset < (uint32_t)chunk->count) {
+            // Show the opcode that actually ran, which may be a quickened
+            // form of what the compiler emitted.
+            uint8_t emitted = chunk->code[event.offset];
+            chunk->code[event.offset] = event.opcode;
+            disassembleInstruction(chunk, (int)event.offset);
+            chunk->code[event.offset] = emitted;
+        } else {
+            printf("<offset %u outside chunk>\n", event.offset);
+        }
+    }
+    return true;
+}
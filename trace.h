@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "chunk.h"
+#include "common.h"
+
+#define TRACE_DEFAULT_CAPACITY 65536
+#define TRACE_EMPTY_STACK 0xFF
+
+typedef struct {
+    uint64_t timestamp; // nanoseconds, 0 unless timestamps are enabled
+    uint32_t offset; // of the instruction within its chunk
+    uint8_t opcode;
+    uint8_t topType; // ValueType of the top of stack, or TRACE_EMPTY_STACK
+    uint16_t depth; // stack depth before the instruction ran
+} TraceEvent;
+
+// A fixed-size ring of the most recent instructions a VM executed. The VM is
+// the only writer; other threads may take snapshots without locking.
+typedef struct {
+    Heap* heap;
+    bool enabled;
+    bool timestamps;
+    uint32_t capacity; // always a power of two
+    TraceEvent* events;
+    uint64_t head; // total number of events ever recorded
+} Tracer;
+
+void initTracer(Tracer* tracer, Heap* heap);
+void freeTracer(Tracer* tracer);
+void enableTracing(Tracer* tracer, uint32_t capacity, bool timestamps);
+void disableTracing(Tracer* tracer);
+void traceInstruction(Tracer* tracer, uint32_t offset, uint8_t opcode, int depth, int topType);
+
+// Copies up to `max` of the most recent events, oldest first, into `out` and
+// returns how many were copied.
+uint32_t snapshotTrace(Tracer* tracer, TraceEvent* out, uint32_t max);
+
+// Binary trace files: a small header followed by the raw events.
+bool writeTrace(Tracer* tracer, FILE* file);
+bool decodeTrace(FILE* file, Chunk* chunk);
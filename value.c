@@ -1,13 +1,15 @@
 #include <stdio.h>
 
 #include "memory.h"
+#include "number.h"
 #include "object.h"
-#include "string.h"
+#include <string.h>
 #include "value.h"
 
-void initValueArray(ValueArray* array)
+void initValueArray(ValueArray* array, Heap* heap)
 {
     *array = (ValueArray) {
+        .heap = heap,
         .values = NULL,
         .capacity = 0,
         .count = 0,
@@ -18,9 +20,10 @@ void writeValueArray(ValueArray* array, Value value)
 {
     if (array->capacity < array->count + 1) {
         int oldCapacity = array->capacity;
-        array->capacity = GROW_CAPACITY(oldCapacity);
-        array->values = GROW_ARRAY(array->values, Value,
-            oldCapacity, array->capacity);
+        int capacity = GROW_CAPACITY(oldCapacity);
+        array->values = GROW_ARRAY(array->heap, array->values, Value,
+            oldCapacity, capacity);
+        array->capacity = capacity;
     }
 
     array->values[array->count] = value;
@@ -29,8 +32,20 @@ void writeValueArray(ValueArray* array, Value value)
 
 void freeValueArray(ValueArray* array)
 {
-    FREE_ARRAY(Value, array->values, array->capacity);
-    initValueArray(array);
+    FREE_ARRAY(array->heap, Value, array->values, array->capacity);
+    initValueArray(array, array->heap);
+}
+
+bool fitsShortString(const char* chars, int length)
+{
+    return length <= SHORT_STRING_MAX && memchr(chars, '\0', length) == NULL;
+}
+
+Value shortStringValue(const char* chars, int length)
+{
+    Value value = { VAL_SHORT_STRING, { .number = 0 } };
+    memcpy(value.as.shortString, chars, length);
+    return value;
 }
 
 void printValue(Value value)
@@ -43,7 +58,20 @@ void printValue(Value value)
         printf("nil");
         break;
     case VAL_NUMBER:
-        printf("%g", AS_NUMBER(value));
+    {
+        char buffer[NUMBER_BUFFER_SIZE];
+        int length = formatNumber(AS_NUMBER(value), buffer);
+        fwrite(buffer, 1, length, stdout);
+        break;
+    }
+    case VAL_INT: {
+        char buffer[NUMBER_BUFFER_SIZE];
+        int length = formatInteger(AS_INT(value), buffer);
+        fwrite(buffer, 1, length, stdout);
+        break;
+    }
+    case VAL_SHORT_STRING:
+        printf("%s", AS_SHORT_STRING(value));
         break;
     case VAL_OBJ:
         printObject(value);
@@ -53,8 +81,81 @@ void printValue(Value value)
     }
 }
 
+void writeValue(Output* out, Value value)
+{
+    switch (value.type) {
+    case VAL_BOOL:
+        if (AS_BOOL(value)) {
+            writeOutput(out, "true", 4);
+        } else {
+            writeOutput(out, "false", 5);
+        }
+        break;
+    case VAL_NIL:
+        writeOutput(out, "nil", 3);
+        break;
+    case VAL_NUMBER: {
+        char* buffer = reserveOutput(out, NUMBER_BUFFER_SIZE);
+        commitOutput(out, formatNumber(AS_NUMBER(value), buffer));
+        break;
+    }
+    case VAL_INT: {
+        char* buffer = reserveOutput(out, NUMBER_BUFFER_SIZE);
+        commitOutput(out, formatInteger(AS_INT(value), buffer));
+        break;
+    }
+    case VAL_SHORT_STRING:
+        writeOutput(out, AS_SHORT_STRING(value), strlen(AS_SHORT_STRING(value)));
+        break;
+    case VAL_OBJ:
+        writeObject(out, value);
+        break;
+    default:
+        break;
+    }
+}
+
+// Exact comparison: no integer equals a double with a fractional part or one
+// outside the int64_t range, and large integers are not rounded first.
+int compareIntDouble(int64_t integer, double number)
+{
+    if (number != number) {
+        return COMPARE_UNORDERED;
+    }
+    if (number < -9223372036854775808.0) {
+        return 1;
+    }
+    if (number >= 9223372036854775808.0) {
+        return -1;
+    }
+    // In range, so the truncation and the fraction are both exact.
+    int64_t truncated = (int64_t)number;
+    if (integer != truncated) {
+        return integer < truncated ? -1 : 1;
+    }
+    double fraction = number - (double)truncated;
+    return fraction > 0 ? -1 : fraction < 0 ? 1 : 0;
+}
+
+static bool intEqualsDouble(int64_t integer, double number)
+{
+    return compareIntDouble(integer, number) == 0;
+}
+
+bool mixedLess(Value a, Value b)
+{
+    if (IS_INT(a)) {
+        return compareIntDouble(AS_INT(a), AS_NUMBER(b)) == -1;
+    }
+    return compareIntDouble(AS_INT(b), AS_NUMBER(a)) == 1;
+}
+
 bool valuesEqual(Value a, Value b)
 {
+    if (IS_INT(a) && IS_NUMBER(b))
+        return intEqualsDouble(AS_INT(a), AS_NUMBER(b));
+    if (IS_NUMBER(a) && IS_INT(b))
+        return intEqualsDouble(AS_INT(b), AS_NUMBER(a));
     if (a.type != b.type)
         return false;
 
@@ -65,12 +166,20 @@ bool valuesEqual(Value a, Value b)
         return true;
     case VAL_NUMBER:
         return AS_NUMBER(a) == AS_NUMBER(b);
+    case VAL_INT:
+        return AS_INT(a) == AS_INT(b);
+    case VAL_SHORT_STRING:
+        return memcmp(AS_SHORT_STRING(a), AS_SHORT_STRING(b), SHORT_STRING_MAX + 1) == 0;
     case VAL_OBJ: {
+        if (!IS_STRING(a) || !IS_STRING(b)) {
+            return AS_OBJ(a) == AS_OBJ(b);
+        }
+        // Scratch strings are not NUL-terminated, so the lengths must match
+        // before any bytes are compared.
         ObjString* aString = AS_STRING(a);
         ObjString* bString = AS_STRING(b);
-        bool lengthEqual = aString->length == bString->length;
-        bool stringEqual = strncmp(aString->chars, bString->chars, aString->length) == 0;
-        return lengthEqual && stringEqual;
+        return aString->length == bString->length
+            && memcmp(aString->chars, bString->chars, aString->length) == 0;
     }
     default:
         return false;
@@ -1,49 +1,125 @@
 #pragma once
 
+#include "allocator.h"
 #include "common.h"
+#include "output.h"
 
 typedef struct Obj Obj;
+typedef struct ObjNative ObjNative;
 typedef struct ObjString ObjString;
 
 typedef enum {
     VAL_BOOL,
     VAL_NIL,
     VAL_NUMBER,
+    VAL_INT,
+    VAL_SHORT_STRING,
     VAL_OBJ
 } ValueType;
 
+// Strings of up to SHORT_STRING_MAX bytes are stored inline in the Value,
+// NUL-padded to the full payload. Longer strings, and strings with a NUL in
+// them, which the padding would cut short, always live on the heap, so a
+// given string has exactly one representation.
+#define SHORT_STRING_MAX 7
+
 typedef struct {
     ValueType type;
     union {
         bool boolean;
         double number;
+        int64_t integer;
         Obj* obj;
+        char shortString[SHORT_STRING_MAX + 1];
     } as;
 } Value;
 
 #define IS_BOOL(value) ((value).type == VAL_BOOL)
 #define IS_NIL(value) ((value).type == VAL_NIL)
 #define IS_NUMBER(value) ((value).type == VAL_NUMBER)
+#define IS_INT(value) ((value).type == VAL_INT)
+// True for both doubles and integers.
+#define IS_NUMERIC(value) (IS_NUMBER(value) || IS_INT(value))
+#define IS_SHORT_STRING(value) ((value).type == VAL_SHORT_STRING)
 #define IS_OBJ(value) ((value).type == VAL_OBJ)
 
 #define AS_BOOL(value) ((value).as.boolean)
 #define AS_NUMBER(value) ((value).as.number)
+#define AS_INT(value) ((value).as.integer)
+// Either numeric kind converted to a double.
+#define AS_DOUBLE(value) (IS_INT(value) ? (double)AS_INT(value) : AS_NUMBER(value))
 #define AS_OBJ(value) ((value).as.obj)
+#define AS_SHORT_STRING(value) ((value).as.shortString)
 
 #define BOOL_VAL(value) ((Value) { VAL_BOOL, { .boolean = value } })
 #define NIL_VAL ((Value) { VAL_NIL, { .number = 0 } })
 #define NUMBER_VAL(value) ((Value) { VAL_NUMBER, { .number = value } })
+#define INT_VAL(value) ((Value) { VAL_INT, { .integer = value } })
 #define OBJ_VAL(object) ((Value) { VAL_OBJ, { .obj = (Obj*)object } })
 
 typedef struct
 {
+    Heap* heap;
     int capacity;
     int count;
     Value* values;
 } ValueArray;
 
+// Integer arithmetic that falls back to doubles when the exact result does
+// not fit in an int64_t.
+static inline Value addInts(int64_t a, int64_t b)
+{
+    int64_t result;
+    if (__builtin_add_overflow(a, b, &result)) {
+        return NUMBER_VAL((double)a + (double)b);
+    }
+    return INT_VAL(result);
+}
+
+static inline Value subtractInts(int64_t a, int64_t b)
+{
+    int64_t result;
+    if (__builtin_sub_overflow(a, b, &result)) {
+        return NUMBER_VAL((double)a - (double)b);
+    }
+    return INT_VAL(result);
+}
+
+static inline Value multiplyInts(int64_t a, int64_t b)
+{
+    int64_t result;
+    if (__builtin_mul_overflow(a, b, &result)) {
+        return NUMBER_VAL((double)a * (double)b);
+    }
+    return INT_VAL(result);
+}
+
+static inline Value negateInt(int64_t a)
+{
+    if (a == INT64_MIN) {
+        return NUMBER_VAL(-(double)a);
+    }
+    return INT_VAL(-a);
+}
+
+// Orders an integer against a double without rounding either: -1, 0 or 1
+// as the integer is less than, equal to or greater than the double, or
+// COMPARE_UNORDERED if the double is NaN.
+#define COMPARE_UNORDERED 2
+int compareIntDouble(int64_t integer, double number);
+// a < b and a > b for one int and one double, compared exactly.
+bool mixedLess(Value a, Value b);
+static inline bool mixedGreater(Value a, Value b)
+{
+    return mixedLess(b, a);
+}
+
+// Whether these characters are stored inline; see SHORT_STRING_MAX.
+bool fitsShortString(const char* chars, int length);
+Value shortStringValue(const char* chars, int length);
 bool valuesEqual(Value a, Value b);
-void initValueArray(ValueArray* array);
+void initValueArray(ValueArray* array, Heap* heap);
 void writeValueArray(ValueArray* array, Value value);
 void freeValueArray(ValueArray* array);
-void printValue(Value value);
\ No newline at end of file
+void printValue(Value value);
+void writeValue(Output* out, Value value);
\ No newline at end of file
@@ -0,0 +1,63 @@
+#include "verifier.h"
+#include "vm.h"
+
+#define FAIL(message)       \
+    do {                    \
+        *error = (message); \
+        *offset = current;  \
+        return false;       \
+    } while (false)
+
+bool verifyChunk(Chunk* chunk, int globalCount, const char** error, int* offset)
+{
+    int current = 0;
+    if (chunk->maxStack < 0 || chunk->maxStack > STACK_MAX) {
+        FAIL("Declared stack size out of range.");
+    }
+
+    int depth = 0;
+    bool returned = false;
+    while (current < chunk->count) {
+        uint8_t instruction = chunk->code[current];
+        if (instruction >= OP_COUNT) {
+            FAIL("Unknown opcode.");
+        }
+        if (returned) {
+            FAIL("Code after OP_RETURN.");
+        }
+
+        const OpInfo* info = &opInfo[instruction];
+        if (current + info->operandBytes >= chunk->count) {
+            FAIL("Truncated instruction.");
+        }
+        if (instruction == OP_CONSTANT && chunk->code[current + 1] >= chunk->constants.count) {
+            FAIL("Constant index out of range.");
+        }
+        if ((instruction == OP_DEFINE_GLOBAL || instruction == OP_GET_GLOBAL || instruction == OP_SET_GLOBAL)
+            && (chunk->code[current + 1] << 8 | chunk->code[current + 2]) >= globalCount) {
+            FAIL("Global slot out of range.");
+        }
+
+        int pops = info->pops;
+        if (instruction == OP_CALL) {
+            pops += chunk->code[current + 1];
+        }
+        if (depth < pops) {
+            FAIL("Stack underflow.");
+        }
+        depth += info->pushes - pops;
+        if (depth > chunk->maxStack) {
+            FAIL("Stack deeper than declared.");
+        }
+
+        returned = instruction == OP_RETURN;
+        current += 1 + info->operandBytes;
+    }
+
+    if (!returned) {
+        FAIL("Chunk does not end in OP_RETURN.");
+    }
+    return true;
+}
+
+#undef FAIL
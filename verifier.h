@@ -0,0 +1,11 @@
+#pragma once
+
+#include "chunk.h"
+
+// Checks that a chunk is safe to hand to run() without further checks:
+// every opcode is known, operands, constant indices and global slots (below
+// `globalCount`) are in bounds, the stack never underflows or exceeds
+// chunk->maxStack (itself capped at STACK_MAX), and execution ends in
+// OP_RETURN. On failure *error describes
+// the problem and *offset points at the offending instruction.
+bool verifyChunk(Chunk* chunk, int globalCount, const char** error, int* offset);
@@ -5,42 +5,176 @@
 #include "compiler.h"
 #include "debug.h"
 #include "memory.h"
+#include "natives.h"
 #include "object.h"
+#include "regchunk.h"
+#include "serialize.h"
+#include "verifier.h"
+#include <setjmp.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 
 static void resetStack(VM* vm)
 {
     vm->stackTop = vm->stack;
 }
 
+static void reportRuntimeError(VM* vm, int line, const char* format, va_list args)
+{
+    vfprintf(stderr, format, args);
+    fputs("\n", stderr);
+    fprintf(stderr, "[line %d] in script\n", line);
+
+    resetStack(vm);
+}
+
+// Reports the line of the instruction before vm->ip, the one that failed.
+// A cancel can be noticed before the first instruction has run, with
+// vm->ip still at the start of the chunk; that reports the first line.
 static void runtimeError(VM* vm, const char* format, ...)
 {
+    size_t instruction = vm->ip > vm->chunk->code ? (size_t)(vm->ip - vm->chunk->code - 1) : 0;
     va_list args;
     va_start(args, format);
-    vfprintf(stderr, format, args);
+    reportRuntimeError(vm, vm->chunk->lines[instruction], format, args);
     va_end(args);
+}
 
-    fputs("\n", stderr);
-
-    size_t instruction = vm->ip - vm->chunk->code - 1;
-    int line = vm->chunk->lines[instruction];
-    fprintf(stderr, "[line %d] in script\n", line);
+// The register engine has no vm->ip; it passes the line itself.
+static void registerError(VM* vm, int line, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    reportRuntimeError(vm, line, format, args);
+    va_end(args);
+}
 
+// The allocation has one slot more than stackCapacity: vm->stack[-1] is a
+// scratch slot that lets run() spill its cached top-of-stack register even
+// when the stack is empty.
+static void reserveStack(VM* vm, int capacity)
+{
+    if (vm->stackCapacity >= capacity && vm->stack != NULL) {
+        return;
+    }
+    Value* base = vm->stack == NULL ? NULL : vm->stack - 1;
+    int oldCount = vm->stack == NULL ? 0 : vm->stackCapacity + 1;
+    base = GROW_ARRAY(&vm->heap, base, Value, oldCount, capacity + 1);
+    vm->stack = base + 1;
+    vm->stackCapacity = capacity;
     resetStack(vm);
 }
 
 void initVM(VM* vm)
 {
+    initVMWithAllocator(vm, &systemAllocator);
+}
+
+void initVMWithAllocator(VM* vm, const Allocator* allocator)
+{
+    initHeap(&vm->heap, allocator);
+    vm->stack = NULL;
+    vm->stackCapacity = 0;
     resetStack(vm);
     vm->objects = NULL;
+    initRegion(&vm->scratch, &vm->heap);
+    vm->natives = NULL;
+    vm->nativeCount = 0;
+    vm->nativeCapacity = 0;
+    initGlobals(&vm->globals, &vm->heap);
+    initOutput(&vm->out, &vm->heap, STDOUT_FILENO);
+    initTracer(&vm->tracer, &vm->heap);
+    initSite(&vm->site);
+    vm->perf = NULL;
+    initLatencyStats(&vm->latency, &vm->heap);
+    initChunk(&vm->activeChunk, &vm->heap);
+    initChunkCache(&vm->cache, &vm->heap, CHUNK_CACHE_DEFAULT_BYTES);
+    vm->suspended = false;
+    vm->useRegisters = false;
+    vm->result = NULL;
+    vm->fuel = FUEL_UNLIMITED;
+    vm->cancelled = 0;
+    defineNatives(vm);
+}
+
+static void discardSuspended(VM* vm)
+{
+    if (vm->suspended) {
+        freeChunk(&vm->activeChunk);
+        resetStack(vm);
+        resetRegion(&vm->scratch);
+        vm->suspended = false;
+    }
 }
 
 void freeVM(VM* vm)
 {
+    discardSuspended(vm);
+    freeChunkCache(&vm->cache);
+    freeOutput(&vm->out);
+    freeTracer(&vm->tracer);
+    freeLatencyStats(&vm->latency);
+    if (vm->stack != NULL) {
+        FREE_ARRAY(&vm->heap, Value, vm->stack - 1, vm->stackCapacity + 1);
+    }
+    FREE_ARRAY(&vm->heap, ObjNative*, vm->natives, vm->nativeCapacity);
+    freeGlobals(&vm->globals);
+    freeRegion(&vm->scratch);
     freeObjects(vm);
 }
 
+void setMemoryLimit(VM* vm, size_t limit)
+{
+    vm->heap.limit = limit;
+}
+
+void reserveScratch(VM* vm, size_t bytes)
+{
+    reserveRegion(&vm->scratch, bytes);
+}
+
+void freezeMemory(VM* vm, bool frozen)
+{
+    vm->heap.frozen = frozen;
+}
+
+ObjNative* defineNative(VM* vm, const char* name, int arity, NativeFn function)
+{
+    if (vm->nativeCapacity < vm->nativeCount + 1) {
+        int oldCapacity = vm->nativeCapacity;
+        int capacity = GROW_CAPACITY(oldCapacity);
+        vm->natives = GROW_ARRAY(&vm->heap, vm->natives, ObjNative*, oldCapacity, capacity);
+        vm->nativeCapacity = capacity;
+    }
+    ObjNative* native = newNative(vm, name, arity);
+    native->function = function;
+    vm->natives[vm->nativeCount++] = native;
+    return native;
+}
+
+void defineNumberNative1(VM* vm, const char* name, NativeNumberFn1 function)
+{
+    defineNative(vm, name, 1, NULL)->number1 = function;
+}
+
+void defineNumberNative2(VM* vm, const char* name, NativeNumberFn2 function)
+{
+    defineNative(vm, name, 2, NULL)->number2 = function;
+}
+
+ObjNative* findNative(VM* vm, const char* name, int length)
+{
+    for (int i = 0; i < vm->nativeCount; i++) {
+        ObjNative* native = vm->natives[i];
+        if (strncmp(native->name, name, length) == 0 && native->name[length] == '\0') {
+            return native;
+        }
+    }
+    return NULL;
+}
+
 void push(VM* vm, Value value)
 {
     *vm->stackTop = value;
@@ -53,45 +187,198 @@ Value pop(VM* vm)
     return *vm->stackTop;
 }
 
-static Value peek(VM* vm, int distance)
-{
-    return vm->stackTop[-1 - distance];
-}
-
 static bool isFalsey(Value value)
 {
     return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
 
-static void concatenate(VM* vm)
+// Calls the native in callee[0] with the argCount values after it and stores
+// the result in callee[0]. Reports the error and returns false if the call is
+// invalid; `line` is used by the register engine, which has no vm->ip.
+static bool callValue(VM* vm, Value* callee, int argCount, int line)
 {
-    ObjString* a = AS_STRING(pop(vm));
-    ObjString* b = AS_STRING(pop(vm));
+#define CALL_ERROR(...)                                   \
+    do {                                                  \
+        if (line < 0) {                                   \
+            runtimeError(vm, __VA_ARGS__);                \
+        } else {                                          \
+            registerError(vm, line, __VA_ARGS__);         \
+        }                                                 \
+        return false;                                     \
+    } while (false)
 
-    char* s = NULL;
-    asprintf(&s, "%s%s", b->chars, a->chars);
+    if (!IS_NATIVE(*callee)) {
+        CALL_ERROR("Can only call functions.");
+    }
+    ObjNative* native = AS_NATIVE(*callee);
+    if (argCount != native->arity) {
+        CALL_ERROR("Expected %d arguments but got %d.", native->arity, argCount);
+    }
+    Value* args = callee + 1;
+    if (native->function != NULL) {
+        *callee = native->function(argCount, args);
+        return true;
+    }
 
-    int length = a->length + b->length;
-    push(vm, OBJ_VAL(takeString(vm, s, length)));
+    // Numeric natives: unbox straight into the C call.
+    for (int i = 0; i < argCount; i++) {
+        if (!IS_NUMERIC(args[i])) {
+            CALL_ERROR("Arguments to '%s' must be numbers.", native->name);
+        }
+    }
+    if (argCount == 1) {
+        *callee = NUMBER_VAL(native->number1(AS_DOUBLE(args[0])));
+    } else {
+        *callee = NUMBER_VAL(native->number2(AS_DOUBLE(args[0]), AS_DOUBLE(args[1])));
+    }
+    return true;
+#undef CALL_ERROR
+}
+
+// Takes the next batch of instructions run() may execute before it checks
+// the fuel budget and the cancel flag again.
+static int takeSlice(VM* vm)
+{
+    if (vm->fuel == FUEL_UNLIMITED) {
+        return FUEL_CHECK_INTERVAL;
+    }
+    int slice = vm->fuel < FUEL_CHECK_INTERVAL ? (int)vm->fuel : FUEL_CHECK_INTERVAL;
+    vm->fuel -= slice;
+    return slice;
 }
 
 static InterpretResult run(VM* vm)
 {
-#define READ_BYTE() (*vm->ip++)
+    // The instruction pointer, the stack pointer and the top of the stack
+    // are kept in locals so they can live in registers. `top` caches the
+    // topmost value and *sp is its home slot; both are written back to the
+    // VM (SYNC) only before leaving run() or calling code that reads the VM
+    // stack.
+    uint8_t* ip = vm->ip;
+    Value* sp = vm->stackTop - 1;
+    Value top = *sp;
+    int slice = takeSlice(vm);
+
+#define READ_BYTE() (*ip++)
 #define READ_CONSTANT() (vm->chunk->constants.values[READ_BYTE()])
-#define BINARY_OP(valueType, op)                                  \
-    do {                                                          \
-        if (!IS_NUMBER(peek(vm, 0)) || !IS_NUMBER(peek(vm, 1))) { \
-            runtimeError(vm, "Operands must be numbers.");        \
-            return INTERPRET_RUNTIME_ERROR;                       \
-        }                                                         \
-        double b = AS_NUMBER(pop(vm));                            \
-        double a = AS_NUMBER(pop(vm));                            \
-        push(vm, valueType(a op b));                              \
+#define READ_SHORT() (ip += 2, (uint16_t)(ip[-2] << 8 | ip[-1]))
+#define SYNC()                  \
+    do {                        \
+        vm->ip = ip;            \
+        *sp = top;              \
+        vm->stackTop = sp + 1;  \
+    } while (false)
+#define PUSH(value)     \
+    do {                \
+        *sp++ = top;    \
+        top = (value);  \
+    } while (false)
+#define DROP() (top = *--sp)
+#define RUNTIME_ERROR(...)                  \
+    do {                                    \
+        SYNC();                             \
+        runtimeError(vm, __VA_ARGS__);      \
+        return INTERPRET_RUNTIME_ERROR;     \
+    } while (false)
+#define UNDEFINED_ERROR(slot)                                                   \
+    do {                                                                        \
+        GlobalName* name = &vm->globals.names[slot];                            \
+        RUNTIME_ERROR("Undefined variable '%.*s'.", name->length, name->chars); \
+    } while (false)
+#define NUMBER_OPERANDS() (IS_NUMBER(top) && IS_NUMBER(sp[-1]))
+#define INT_OPERANDS() (IS_INT(top) && IS_INT(sp[-1]))
+#define NUMERIC_OPERANDS() (IS_NUMERIC(top) && IS_NUMERIC(sp[-1]))
+// Replace the two topmost values with `a op b`, for two doubles, two
+// integers and any mix of the two respectively.
+#define QUICK_BINARY_OP(valueType, op)                     \
+    do {                                                   \
+        double b = AS_NUMBER(top);                         \
+        double a = AS_NUMBER(*--sp);                       \
+        top = valueType(a op b);                           \
+    } while (false)
+#define INT_BINARY_OP(function)                            \
+    do {                                                   \
+        int64_t b = AS_INT(top);                           \
+        int64_t a = AS_INT(*--sp);                         \
+        top = function(a, b);                              \
+    } while (false)
+#define INT_COMPARISON_OP(op)                              \
+    do {                                                   \
+        int64_t b = AS_INT(top);                           \
+        int64_t a = AS_INT(*--sp);                         \
+        top = BOOL_VAL(a op b);                            \
+    } while (false)
+#define MIXED_BINARY_OP(valueType, op)                     \
+    do {                                                   \
+        Value a = *--sp;                                   \
+        top = valueType(AS_DOUBLE(a) op AS_DOUBLE(top));   \
+    } while (false)
+// One int and one double, compared exactly; see compareIntDouble().
+#define MIXED_COMPARISON_OP(compare)                       \
+    do {                                                   \
+        Value a = *--sp;                                   \
+        top = BOOL_VAL(compare(a, top));                   \
+    } while (false)
+// Rewrites the instruction that is currently executing.
+#define QUICKEN(opcode) (ip[-1] = (opcode))
+// Restores the generic instruction and re-dispatches it, so the generic
+// handler deals with the operands that missed the guard.
+#define DEOPTIMIZE(opcode)  \
+    do {                    \
+        ip[-1] = (opcode);  \
+        ip--;               \
+    } while (false)
+// Generic handlers: pick the integer or double path, quickening the
+// instruction when both operands have the same numeric kind.
+#define ARITHMETIC_OP(op, intFunction, numberOpcode, intOpcode, message) \
+    do {                                                                   \
+        if (INT_OPERANDS()) {                                              \
+            QUICKEN(intOpcode);                                            \
+            INT_BINARY_OP(intFunction);                                    \
+        } else if (NUMBER_OPERANDS()) {                                    \
+            QUICKEN(numberOpcode);                                         \
+            QUICK_BINARY_OP(NUMBER_VAL, op);                               \
+        } else if (NUMERIC_OPERANDS()) {                                   \
+            MIXED_BINARY_OP(NUMBER_VAL, op);                               \
+        } else {                                                           \
+            RUNTIME_ERROR(message);                                        \
+        }                                                                  \
+    } while (false)
+#define COMPARISON_OP(op, mixed, numberOpcode, intOpcode)                  \
+    do {                                                                   \
+        if (INT_OPERANDS()) {                                              \
+            QUICKEN(intOpcode);                                            \
+            INT_COMPARISON_OP(op);                                         \
+        } else if (NUMBER_OPERANDS()) {                                    \
+            QUICKEN(numberOpcode);                                         \
+            QUICK_BINARY_OP(BOOL_VAL, op);                                 \
+        } else if (NUMERIC_OPERANDS()) {                                   \
+            MIXED_COMPARISON_OP(mixed);                                    \
+        } else {                                                           \
+            RUNTIME_ERROR("Operands must be numbers.");                    \
+        }                                                                  \
     } while (false)
 
     for (;;) {
+        if (slice-- == 0) {
+            SYNC();
+            if (__atomic_load_n(&vm->cancelled, __ATOMIC_RELAXED)) {
+                runtimeError(vm, "Execution cancelled.");
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            if (vm->fuel == 0) {
+                return INTERPRET_YIELD;
+            }
+            slice = takeSlice(vm) - 1;
+        }
+        vm->site.at = (uintptr_t)ip;
+        if (vm->tracer.enabled) {
+            int depth = (int)(sp + 1 - vm->stack);
+            traceInstruction(&vm->tracer, (uint32_t)(ip - vm->chunk->code), *ip,
+                depth, depth > 0 ? (int)top.type : TRACE_EMPTY_STACK);
+        }
 #ifdef DEBUG_TRACE_EXECUTION
+        SYNC();
         printf("          ");
         for (Value* slot = vm->stack; slot < vm->stackTop; slot++) {
             printf("[ ");
@@ -99,93 +386,726 @@ static InterpretResult run(VM* vm)
             printf(" ]");
         }
         printf("\n");
-        disassembleInstruction(vm->chunk, (int)(vm->ip - vm->chunk->code));
+        disassembleInstruction(vm->chunk, (int)(ip - vm->chunk->code));
 #endif
         uint8_t instruction;
         switch (instruction = READ_BYTE()) {
         case OP_ADD: {
-            if (IS_STRING(peek(vm, 0)) && IS_STRING(peek(vm, 1))) {
-                concatenate(vm);
-            } else if (IS_NUMBER(peek(vm, 0)) && IS_NUMBER(peek(vm, 1))) {
-                BINARY_OP(NUMBER_VAL, +);
+            if (IS_ANY_STRING(top) && IS_ANY_STRING(sp[-1])) {
+                QUICKEN(OP_ADD_STR);
+                Value b = top;
+                Value a = *--sp;
+                if (!concatenate(vm, a, b, &top)) {
+                    RUNTIME_ERROR("String is too long.");
+                }
             } else {
-                runtimeError(vm, "Operands must be two numbers or two strings.");
-                return INTERPRET_RUNTIME_ERROR;
+                ARITHMETIC_OP(+, addInts, OP_ADD_NUM, OP_ADD_INT,
+                    "Operands must be two numbers or two strings.");
             }
             break;
         }
         case OP_SUBTRACT:
-            BINARY_OP(NUMBER_VAL, -);
+            ARITHMETIC_OP(-, subtractInts, OP_SUBTRACT_NUM, OP_SUBTRACT_INT,
+                "Operands must be numbers.");
             break;
         case OP_MULTIPLY:
-            BINARY_OP(NUMBER_VAL, *);
+            ARITHMETIC_OP(*, multiplyInts, OP_MULTIPLY_NUM, OP_MULTIPLY_INT,
+                "Operands must be numbers.");
             break;
         case OP_DIVIDE:
-            BINARY_OP(NUMBER_VAL, /);
+            // Division always produces a double.
+            if (NUMBER_OPERANDS()) {
+                QUICKEN(OP_DIVIDE_NUM);
+                QUICK_BINARY_OP(NUMBER_VAL, /);
+            } else if (NUMERIC_OPERANDS()) {
+                MIXED_BINARY_OP(NUMBER_VAL, /);
+            } else {
+                RUNTIME_ERROR("Operands must be numbers.");
+            }
             break;
         case OP_NOT:
-            push(vm, BOOL_VAL(isFalsey(pop(vm))));
+            top = BOOL_VAL(isFalsey(top));
             break;
         case OP_NEGATE:
-            if (!IS_NUMBER(peek(vm, 0))) {
-                runtimeError(vm, "Operand must be a number.");
+            if (IS_INT(top)) {
+                QUICKEN(OP_NEGATE_INT);
+                top = negateInt(AS_INT(top));
+            } else if (IS_NUMBER(top)) {
+                QUICKEN(OP_NEGATE_NUM);
+                top = NUMBER_VAL(-AS_NUMBER(top));
+            } else {
+                RUNTIME_ERROR("Operand must be a number.");
+            }
+            break;
+        case OP_CALL: {
+            int argCount = READ_BYTE();
+            SYNC();
+            Value* callee = sp - argCount;
+            if (!callValue(vm, callee, argCount, -1)) {
                 return INTERPRET_RUNTIME_ERROR;
             }
-            push(vm, NUMBER_VAL(-AS_NUMBER(pop(vm))));
+            sp = callee;
+            top = *callee;
             break;
+        }
         case OP_RETURN:
-            printValue(pop(vm));
-            printf("\n");
+            if (vm->result != NULL) {
+                *vm->result = keepValue(vm, top);
+            } else {
+                writeValue(&vm->out, top);
+                writeOutput(&vm->out, "\n", 1);
+            }
+            DROP();
+            SYNC();
             return INTERPRET_OK;
+        case OP_POP:
+            DROP();
+            break;
+        case OP_DEFINE_GLOBAL: {
+            int slot = READ_SHORT();
+            vm->globals.values[slot] = keepValue(vm, top);
+            DROP();
+            break;
+        }
+        case OP_GET_GLOBAL: {
+            int slot = READ_SHORT();
+            Value value = vm->globals.values[slot];
+            if (IS_UNDEFINED(value)) {
+                UNDEFINED_ERROR(slot);
+            }
+            PUSH(value);
+            break;
+        }
+        case OP_SET_GLOBAL: {
+            // Assignment is an expression: the value stays on the stack.
+            int slot = READ_SHORT();
+            if (IS_UNDEFINED(vm->globals.values[slot])) {
+                UNDEFINED_ERROR(slot);
+            }
+            vm->globals.values[slot] = keepValue(vm, top);
+            break;
+        }
         case OP_CONSTANT: {
             Value constant = READ_CONSTANT();
-            push(vm, constant);
+            PUSH(constant);
             break;
         }
         case OP_NIL:
-            push(vm, NIL_VAL);
+            PUSH(NIL_VAL);
             break;
         case OP_TRUE:
-            push(vm, BOOL_VAL(true));
+            PUSH(BOOL_VAL(true));
             break;
         case OP_FALSE:
-            push(vm, BOOL_VAL(false));
+            PUSH(BOOL_VAL(false));
             break;
         case OP_EQUAL: {
-            Value b = pop(vm);
-            Value a = pop(vm);
-            push(vm, BOOL_VAL(valuesEqual(a, b)));
+            if (NUMBER_OPERANDS()) {
+                QUICKEN(OP_EQUAL_NUM);
+            } else if (INT_OPERANDS()) {
+                QUICKEN(OP_EQUAL_INT);
+            }
+            Value b = top;
+            Value a = *--sp;
+            top = BOOL_VAL(valuesEqual(a, b));
             break;
         }
         case OP_GREATER:
-            BINARY_OP(BOOL_VAL, >);
+            COMPARISON_OP(>, mixedGreater, OP_GREATER_NUM, OP_GREATER_INT);
             break;
         case OP_LESS:
-            BINARY_OP(BOOL_VAL, <);
+            COMPARISON_OP(<, mixedLess, OP_LESS_NUM, OP_LESS_INT);
+            break;
+        case OP_ADD_NUM:
+            if (!NUMBER_OPERANDS()) {
+                DEOPTIMIZE(OP_ADD);
+                break;
+            }
+            QUICK_BINARY_OP(NUMBER_VAL, +);
+            break;
+        case OP_ADD_STR: {
+            if (!IS_ANY_STRING(top) || !IS_ANY_STRING(sp[-1])) {
+                DEOPTIMIZE(OP_ADD);
+                break;
+            }
+            Value b = top;
+            Value a = *--sp;
+            if (!concatenate(vm, a, b, &top)) {
+                RUNTIME_ERROR("String is too long.");
+            }
+            break;
+        }
+        case OP_SUBTRACT_NUM:
+            if (!NUMBER_OPERANDS()) {
+                DEOPTIMIZE(OP_SUBTRACT);
+                break;
+            }
+            QUICK_BINARY_OP(NUMBER_VAL, -);
+            break;
+        case OP_MULTIPLY_NUM:
+            if (!NUMBER_OPERANDS()) {
+                DEOPTIMIZE(OP_MULTIPLY);
+                break;
+            }
+            QUICK_BINARY_OP(NUMBER_VAL, *);
+            break;
+        case OP_DIVIDE_NUM:
+            if (!NUMBER_OPERANDS()) {
+                DEOPTIMIZE(OP_DIVIDE);
+                break;
+            }
+            QUICK_BINARY_OP(NUMBER_VAL, /);
+            break;
+        case OP_EQUAL_NUM:
+            if (!NUMBER_OPERANDS()) {
+                DEOPTIMIZE(OP_EQUAL);
+                break;
+            }
+            QUICK_BINARY_OP(BOOL_VAL, ==);
+            break;
+        case OP_GREATER_NUM:
+            if (!NUMBER_OPERANDS()) {
+                DEOPTIMIZE(OP_GREATER);
+                break;
+            }
+            QUICK_BINARY_OP(BOOL_VAL, >);
+            break;
+        case OP_LESS_NUM:
+            if (!NUMBER_OPERANDS()) {
+                DEOPTIMIZE(OP_LESS);
+                break;
+            }
+            QUICK_BINARY_OP(BOOL_VAL, <);
+            break;
+        case OP_NEGATE_NUM:
+            if (!IS_NUMBER(top)) {
+                DEOPTIMIZE(OP_NEGATE);
+                break;
+            }
+            top = NUMBER_VAL(-AS_NUMBER(top));
+            break;
+        case OP_ADD_INT:
+            if (!INT_OPERANDS()) {
+                DEOPTIMIZE(OP_ADD);
+                break;
+            }
+            INT_BINARY_OP(addInts);
+            break;
+        case OP_SUBTRACT_INT:
+            if (!INT_OPERANDS()) {
+                DEOPTIMIZE(OP_SUBTRACT);
+                break;
+            }
+            INT_BINARY_OP(subtractInts);
+            break;
+        case OP_MULTIPLY_INT:
+            if (!INT_OPERANDS()) {
+                DEOPTIMIZE(OP_MULTIPLY);
+                break;
+            }
+            INT_BINARY_OP(multiplyInts);
+            break;
+        case OP_EQUAL_INT:
+            if (!INT_OPERANDS()) {
+                DEOPTIMIZE(OP_EQUAL);
+                break;
+            }
+            INT_COMPARISON_OP(==);
+            break;
+        case OP_GREATER_INT:
+            if (!INT_OPERANDS()) {
+                DEOPTIMIZE(OP_GREATER);
+                break;
+            }
+            INT_COMPARISON_OP(>);
+            break;
+        case OP_LESS_INT:
+            if (!INT_OPERANDS()) {
+                DEOPTIMIZE(OP_LESS);
+                break;
+            }
+            INT_COMPARISON_OP(<);
+            break;
+        case OP_NEGATE_INT:
+            if (!IS_INT(top)) {
+                DEOPTIMIZE(OP_NEGATE);
+                break;
+            }
+            top = negateInt(AS_INT(top));
             break;
         }
     }
 #undef READ_BYTE
 #undef READ_CONSTANT
-#undef BINARY_OP
+#undef READ_SHORT
+#undef SYNC
+#undef PUSH
+#undef DROP
+#undef RUNTIME_ERROR
+#undef UNDEFINED_ERROR
+#undef NUMBER_OPERANDS
+#undef INT_OPERANDS
+#undef NUMERIC_OPERANDS
+#undef QUICK_BINARY_OP
+#undef INT_BINARY_OP
+#undef INT_COMPARISON_OP
+#undef MIXED_BINARY_OP
+#undef MIXED_COMPARISON_OP
+#undef ARITHMETIC_OP
+#undef COMPARISON_OP
+#undef QUICKEN
+#undef DEOPTIMIZE
 }
 
-InterpretResult interpret(VM* vm, const char* source)
+// The register engine: operands are read straight from registers or
+// constants, so a binary operation is one dispatch and no stack traffic. Type
+// checks and errors match run() exactly.
+static InterpretResult runRegisters(VM* vm, RegChunk* chunk)
 {
-    Chunk chunk;
-    initChunk(&chunk);
+    Value* r = vm->stack;
+    Value* k = chunk->constants.values;
+    RegInstruction* ip = chunk->code;
 
-    if (!compile(vm, source, &chunk)) {
-        freeChunk(&chunk);
-        return INTERPRET_COMPILE_ERROR;
+#define RK_B(instruction) \
+    (((instruction)->flags & REG_B_CONSTANT) ? k[(instruction)->b] : r[(instruction)->b])
+#define RK_C(instruction) \
+    (((instruction)->flags & REG_C_CONSTANT) ? k[(instruction)->c] : r[(instruction)->c])
+#define REGISTER_ERROR(...)                                                      \
+    do {                                                                         \
+        registerError(vm, chunk->lines[instruction - chunk->code], __VA_ARGS__); \
+        return INTERPRET_RUNTIME_ERROR;                                          \
+    } while (false)
+#define REGISTER_UNDEFINED_ERROR(slot)                                           \
+    do {                                                                         \
+        GlobalName* name = &vm->globals.names[slot];                             \
+        REGISTER_ERROR("Undefined variable '%.*s'.", name->length, name->chars); \
+    } while (false)
+#define REGISTER_ARITHMETIC_OP(op, intFunction, message)                         \
+    do {                                                                         \
+        Value b = RK_B(instruction);                                             \
+        Value c = RK_C(instruction);                                             \
+        if (IS_INT(b) && IS_INT(c)) {                                            \
+            r[instruction->a] = intFunction(AS_INT(b), AS_INT(c));               \
+        } else if (IS_NUMERIC(b) && IS_NUMERIC(c)) {                             \
+            r[instruction->a] = NUMBER_VAL(AS_DOUBLE(b) op AS_DOUBLE(c));        \
+        } else {                                                                 \
+            REGISTER_ERROR(message);                                             \
+        }                                                                        \
+    } while (false)
+#define REGISTER_COMPARISON_OP(op, mixed)                                        \
+    do {                                                                         \
+        Value b = RK_B(instruction);                                             \
+        Value c = RK_C(instruction);                                             \
+        if (IS_INT(b) && IS_INT(c)) {                                            \
+            r[instruction->a] = BOOL_VAL(AS_INT(b) op AS_INT(c));                \
+        } else if (IS_NUMBER(b) && IS_NUMBER(c)) {                               \
+            r[instruction->a] = BOOL_VAL(AS_NUMBER(b) op AS_NUMBER(c));          \
+        } else if (IS_NUMERIC(b) && IS_NUMERIC(c)) {                             \
+            r[instruction->a] = BOOL_VAL(mixed(b, c));                           \
+        } else {                                                                 \
+            REGISTER_ERROR("Operands must be numbers.");                         \
+        }                                                                        \
+    } while (false)
+
+    // There are no jumps, so the cancel flag is checked at every
+    // FUEL_CHECK_INTERVAL-th instruction of the chunk, if it has that many.
+    RegInstruction* end = chunk->code + chunk->count;
+    RegInstruction* checkpoint = chunk->count > FUEL_CHECK_INTERVAL ? ip + FUEL_CHECK_INTERVAL : NULL;
+    for (;;) {
+        RegInstruction* instruction = ip++;
+        vm->site.at = (uintptr_t)instruction;
+        if (instruction == checkpoint) {
+            checkpoint = end - checkpoint > FUEL_CHECK_INTERVAL ? checkpoint + FUEL_CHECK_INTERVAL : NULL;
+            if (__atomic_load_n(&vm->cancelled, __ATOMIC_RELAXED)) {
+                REGISTER_ERROR("Execution cancelled.");
+            }
+        }
+        switch (instruction->op) {
+        case REG_LOAD_CONSTANT:
+            r[instruction->a] = k[instruction->b];
+            break;
+        case REG_ADD: {
+            Value b = RK_B(instruction);
+            Value c = RK_C(instruction);
+            if (IS_ANY_STRING(b) && IS_ANY_STRING(c)) {
+                if (!concatenate(vm, b, c, &r[instruction->a])) {
+                    REGISTER_ERROR("String is too long.");
+                }
+            } else {
+                REGISTER_ARITHMETIC_OP(+, addInts, "Operands must be two numbers or two strings.");
+            }
+            break;
+        }
+        case REG_SUBTRACT:
+            REGISTER_ARITHMETIC_OP(-, subtractInts, "Operands must be numbers.");
+            break;
+        case REG_MULTIPLY:
+            REGISTER_ARITHMETIC_OP(*, multiplyInts, "Operands must be numbers.");
+            break;
+        case REG_DIVIDE: {
+            Value b = RK_B(instruction);
+            Value c = RK_C(instruction);
+            if (!IS_NUMERIC(b) || !IS_NUMERIC(c)) {
+                REGISTER_ERROR("Operands must be numbers.");
+            }
+            r[instruction->a] = NUMBER_VAL(AS_DOUBLE(b) / AS_DOUBLE(c));
+            break;
+        }
+        case REG_EQUAL:
+            r[instruction->a] = BOOL_VAL(valuesEqual(RK_B(instruction), RK_C(instruction)));
+            break;
+        case REG_GREATER:
+            REGISTER_COMPARISON_OP(>, mixedGreater);
+            break;
+        case REG_LESS:
+            REGISTER_COMPARISON_OP(<, mixedLess);
+            break;
+        case REG_NOT:
+            r[instruction->a] = BOOL_VAL(isFalsey(RK_B(instruction)));
+            break;
+        case REG_NEGATE: {
+            Value b = RK_B(instruction);
+            if (IS_INT(b)) {
+                r[instruction->a] = negateInt(AS_INT(b));
+            } else if (IS_NUMBER(b)) {
+                r[instruction->a] = NUMBER_VAL(-AS_NUMBER(b));
+            } else {
+                REGISTER_ERROR("Operand must be a number.");
+            }
+            break;
+        }
+        case REG_CALL:
+            if (!callValue(vm, &r[instruction->a], instruction->b,
+                    chunk->lines[instruction - chunk->code])) {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            break;
+        case REG_GET_GLOBAL: {
+            Value value = vm->globals.values[instruction->b];
+            if (IS_UNDEFINED(value)) {
+                REGISTER_UNDEFINED_ERROR(instruction->b);
+            }
+            r[instruction->a] = value;
+            break;
+        }
+        case REG_SET_GLOBAL:
+            if (IS_UNDEFINED(vm->globals.values[instruction->a])) {
+                REGISTER_UNDEFINED_ERROR(instruction->a);
+            }
+            vm->globals.values[instruction->a] = keepValue(vm, RK_B(instruction));
+            break;
+        case REG_DEFINE_GLOBAL:
+            vm->globals.values[instruction->a] = keepValue(vm, RK_B(instruction));
+            break;
+        case REG_RETURN:
+            if (vm->result != NULL) {
+                *vm->result = keepValue(vm, RK_B(instruction));
+            } else {
+                writeValue(&vm->out, RK_B(instruction));
+                writeOutput(&vm->out, "\n", 1);
+            }
+            return INTERPRET_OK;
+        }
     }
 
-    vm->chunk = &chunk;
-    vm->ip = vm->chunk->code;
+#undef RK_B
+#undef RK_C
+#undef REGISTER_ERROR
+#undef REGISTER_UNDEFINED_ERROR
+#undef REGISTER_ARITHMETIC_OP
+#undef REGISTER_COMPARISON_OP
+}
 
-    InterpretResult result = run(vm);
+// Picks the register engine for an evaluation that is about to start. It
+// checks the cancel flag as often as run() does, but it cannot suspend an
+// evaluation or trace one, so evaluations with fuel or tracing stay on the
+// stack engine, as do chunks it cannot translate.
+static RegChunk* registerChunk(VM* vm, Chunk* chunk, long fuel)
+{
+    if (!vm->useRegisters || fuel != FUEL_UNLIMITED || vm->tracer.enabled) {
+        return NULL;
+    }
+    if (chunk->registers == NULL) {
+        // Attached before translating so that it is freed along with the
+        // chunk if the translation runs out of memory. translateChunk()
+        // leaves it empty then, and the next evaluation tries again.
+        chunk->registers = ALLOCATE(&vm->heap, RegChunk, 1);
+        initRegChunk(chunk->registers, &vm->heap);
+    }
+    if (chunk->registers->count == 0) {
+        if (!translateChunk(chunk, chunk->registers)) {
+            FREE(&vm->heap, RegChunk, chunk->registers);
+            chunk->registers = NULL;
+            return NULL;
+        }
+#ifdef DEBUG_PRINT_CODE
+        disassembleRegChunk(chunk->registers, "registers");
+#endif
+    }
+    return chunk->registers;
+}
+
+// Scanning is interleaved with compilation, so it is measured as a separate
+// pass over the source.
+static void measureScan(PerfCounters* perf, const char* source)
+{
+    Scanner scanner;
+    initScanner(&scanner, source);
 
-    freeChunk(&chunk);
+    beginPerfPhase(perf);
+    while (scanToken(&scanner).type != TOKEN_EOF)
+        ;
+    endPerfPhase(perf, PERF_PHASE_SCAN);
+}
 
+static InterpretResult finishEvaluation(VM* vm, InterpretResult result)
+{
+    vm->latency.results[result]++;
+    if (takeLatencySignal()) {
+        reportLatency(&vm->latency, stderr);
+    }
     return result;
 }
+
+static InterpretResult execute(VM* vm, long fuel, RegChunk* registers)
+{
+    vm->fuel = fuel;
+    if (vm->perf != NULL) {
+        beginPerfPhase(vm->perf);
+    }
+    if (registers != NULL) {
+        enterSite(&vm->site, registers->code, registers->lines, registers->count, true);
+    } else {
+        enterSite(&vm->site, vm->chunk->code, vm->chunk->lines, vm->chunk->count, false);
+    }
+    uint64_t start = latencyNow();
+    InterpretResult result = registers != NULL ? runRegisters(vm, registers) : run(vm);
+    uint64_t ran = latencyNow();
+    leaveSite(&vm->site);
+    recordLatency(&vm->latency, LATENCY_EXECUTE, ran - start);
+    if (vm->perf != NULL) {
+        endPerfPhase(vm->perf, PERF_PHASE_RUN);
+    }
+
+    vm->suspended = result == INTERPRET_YIELD;
+    if (!vm->suspended) {
+        // Whatever escaped the evaluation was copied out of the region when
+        // it escaped; see keepValue().
+        resetRegion(&vm->scratch);
+        freeChunk(&vm->activeChunk);
+        recordLatency(&vm->latency, LATENCY_TEARDOWN, latencyNow() - ran);
+    }
+    return finishEvaluation(vm, result);
+}
+
+static bool verifyActiveChunk(VM* vm)
+{
+    const char* error;
+    int offset;
+    if (!verifyChunk(&vm->activeChunk, vm->globals.count, &error, &offset)) {
+        fprintf(stderr, "Invalid bytecode at offset %d: %s\n", offset, error);
+        freeChunk(&vm->activeChunk);
+        return false;
+    }
+    return true;
+}
+
+// Compiles and verifies `source` into vm->activeChunk.
+static bool compileSource(VM* vm, const char* source)
+{
+    Chunk* chunk = &vm->activeChunk;
+    initChunk(chunk, &vm->heap);
+
+    if (vm->perf != NULL) {
+        measureScan(vm->perf, source);
+        beginPerfPhase(vm->perf);
+    }
+    bool compiled = compile(vm, source, chunk);
+    if (vm->perf != NULL) {
+        endPerfPhase(vm->perf, PERF_PHASE_COMPILE);
+    }
+
+    if (!compiled) {
+        freeChunk(chunk);
+        return false;
+    }
+    return verifyActiveChunk(vm);
+}
+
+// Both paths into run() end here: the verifier has bounded the stack depth,
+// so run() can push and pop without checks.
+static InterpretResult start(VM* vm, Chunk* chunk, uint64_t started, long fuel)
+{
+    reserveStack(vm, chunk->maxStack);
+    recordLatency(&vm->latency, LATENCY_COMPILE, latencyNow() - started);
+
+    vm->chunk = chunk;
+    vm->ip = chunk->code;
+
+    return execute(vm, fuel, registerChunk(vm, chunk, fuel));
+}
+
+// Where an evaluation lands when the heap runs out. Whatever it was building
+// is reachable from the VM, so dropping the active chunk frees it; objects
+// stay on vm->objects as always. The cache is the one large thing the VM can
+// give back, so it goes too, unless the heap is frozen: then nothing freed
+// could be allocated again, and the warm cache is what keeps the VM working.
+static InterpretResult outOfMemory(VM* vm)
+{
+    vm->heap.recover = NULL;
+    leaveSite(&vm->site);
+    freeChunk(&vm->activeChunk);
+    if (!vm->heap.frozen) {
+        freeChunkCache(&vm->cache);
+    }
+    resetRegion(&vm->scratch);
+    vm->suspended = false;
+    resetStack(vm);
+    fprintf(stderr, "Out of memory.\n");
+    return finishEvaluation(vm, INTERPRET_RUNTIME_ERROR);
+}
+
+// Runs `body` with allocation failures jumping back here. Nothing the body
+// changes is read after the jump except through `vm`.
+#define RECOVERABLE(vm, body)                  \
+    do {                                       \
+        jmp_buf recover;                       \
+        if (setjmp(recover)) {                 \
+            return outOfMemory(vm);            \
+        }                                      \
+        (vm)->heap.recover = &recover;         \
+        InterpretResult result = (body);       \
+        (vm)->heap.recover = NULL;             \
+        return result;                         \
+    } while (false)
+
+static InterpretResult evaluateSource(VM* vm, const char* source, long fuel)
+{
+    uint64_t started = latencyNow();
+    vm->latency.evaluations++;
+    discardSuspended(vm);
+    __atomic_store_n(&vm->cancelled, 0, __ATOMIC_RELAXED);
+
+    // Nothing can be running here, so inserting may evict any entry.
+    size_t length = strlen(source);
+    Chunk* chunk = findCachedChunk(&vm->cache, source, length);
+    if (chunk == NULL) {
+        if (!compileSource(vm, source)) {
+            recordLatency(&vm->latency, LATENCY_COMPILE, latencyNow() - started);
+            return finishEvaluation(vm, INTERPRET_COMPILE_ERROR);
+        }
+        chunk = cacheChunk(&vm->cache, source, length, &vm->activeChunk);
+        if (chunk == NULL) {
+            chunk = &vm->activeChunk;
+        }
+    }
+    InterpretResult result = start(vm, chunk, started, fuel);
+    // The register engine may have attached a translation to a cached chunk.
+    // A suspended evaluation is still running from it, but it ran on the
+    // stack engine, so there is nothing new to charge.
+    if (chunk != &vm->activeChunk && !vm->suspended) {
+        recountCachedChunk(&vm->cache, chunk);
+    }
+    return result;
+}
+
+// Every negative fuel means FUEL_UNLIMITED; the engines only test for -1.
+static long fuelLimit(long fuel)
+{
+    return fuel < 0 ? FUEL_UNLIMITED : fuel;
+}
+
+InterpretResult interpretWithFuel(VM* vm, const char* source, long fuel)
+{
+    RECOVERABLE(vm, evaluateSource(vm, source, fuelLimit(fuel)));
+}
+
+// Verifies vm->activeChunk, built outside the compiler, and runs it.
+static InterpretResult startActiveChunk(VM* vm, uint64_t started, long fuel)
+{
+    if (!verifyActiveChunk(vm)) {
+        recordLatency(&vm->latency, LATENCY_COMPILE, latencyNow() - started);
+        return finishEvaluation(vm, INTERPRET_COMPILE_ERROR);
+    }
+    return start(vm, &vm->activeChunk, started, fuel);
+}
+
+static InterpretResult evaluateChunk(VM* vm, Chunk* chunk)
+{
+    uint64_t started = latencyNow();
+    vm->latency.evaluations++;
+    discardSuspended(vm);
+    __atomic_store_n(&vm->cancelled, 0, __ATOMIC_RELAXED);
+
+    vm->activeChunk = *chunk;
+    initChunk(chunk, chunk->heap);
+    return startActiveChunk(vm, started, FUEL_UNLIMITED);
+}
+
+InterpretResult interpretChunk(VM* vm, Chunk* chunk)
+{
+    RECOVERABLE(vm, evaluateChunk(vm, chunk));
+}
+
+// The image is loaded straight into vm->activeChunk, so that running out of
+// memory part way through frees what was loaded.
+static InterpretResult evaluateImage(VM* vm, const uint8_t* bytes, size_t length, long fuel)
+{
+    uint64_t started = latencyNow();
+    vm->latency.evaluations++;
+    discardSuspended(vm);
+    __atomic_store_n(&vm->cancelled, 0, __ATOMIC_RELAXED);
+
+    if (!deserializeChunk(vm, bytes, length, &vm->activeChunk)) {
+        fprintf(stderr, "Malformed chunk image.\n");
+        recordLatency(&vm->latency, LATENCY_COMPILE, latencyNow() - started);
+        return finishEvaluation(vm, INTERPRET_COMPILE_ERROR);
+    }
+    return startActiveChunk(vm, started, fuel);
+}
+
+InterpretResult interpretImage(VM* vm, const uint8_t* bytes, size_t length, long fuel)
+{
+    RECOVERABLE(vm, evaluateImage(vm, bytes, length, fuelLimit(fuel)));
+}
+
+static InterpretResult evaluateKeptChunk(VM* vm, Chunk* chunk)
+{
+    uint64_t started = latencyNow();
+    vm->latency.evaluations++;
+    discardSuspended(vm);
+    __atomic_store_n(&vm->cancelled, 0, __ATOMIC_RELAXED);
+    return start(vm, chunk, started, FUEL_UNLIMITED);
+}
+
+static InterpretResult runKeptChunk(VM* vm, Chunk* chunk)
+{
+    RECOVERABLE(vm, evaluateKeptChunk(vm, chunk));
+}
+
+InterpretResult runChunk(VM* vm, Chunk* chunk, Value* result)
+{
+    *result = NIL_VAL;
+    vm->result = result;
+    InterpretResult status = runKeptChunk(vm, chunk);
+    vm->result = NULL;
+    return status;
+}
+
+InterpretResult interpret(VM* vm, const char* source)
+{
+    return interpretWithFuel(vm, source, FUEL_UNLIMITED);
+}
+
+InterpretResult resumeInterpret(VM* vm, long fuel)
+{
+    if (!vm->suspended) {
+        return INTERPRET_OK;
+    }
+    RECOVERABLE(vm, execute(vm, fuelLimit(fuel), NULL));
+}
+
+void cancelInterpret(VM* vm)
+{
+    __atomic_store_n(&vm->cancelled, 1, __ATOMIC_RELAXED);
+}
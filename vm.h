@@ -1,27 +1,103 @@
 #pragma once
 
+#include "allocator.h"
+#include "cache.h"
 #include "chunk.h"
+#include "globals.h"
+#include "latency.h"
+#include "output.h"
+#include "perf.h"
+#include "profile.h"
+#include "region.h"
+#include "trace.h"
 #include "value.h"
 
-#define STACK_MAX 256
+// The deepest stack a chunk may declare.
+#define STACK_MAX (1 << 20)
+
+// Passing this, or any other negative fuel, runs an evaluation to completion.
+#define FUEL_UNLIMITED -1
+// Instructions between checks of the fuel budget and the cancel flag.
+#define FUEL_CHECK_INTERVAL 1024
 
 typedef struct
 {
+    Heap heap; // everything below allocates from here; see setMemoryLimit()
     Chunk* chunk;
+    Chunk activeChunk; // the compiled source being evaluated, unless cached
+    ChunkCache cache; // hits skip scanning, compiling and verifying
+    bool suspended; // activeChunk ran out of fuel and can be resumed
     uint8_t* ip; // instruction pointer
-    Value stack[STACK_MAX];
+    Value* stack;
+    int stackCapacity;
     Value* stackTop;
     Obj* objects;
+    Region scratch; // temporaries of the running evaluation
+    ObjNative** natives; // builtins callable by name, see natives.c
+    int nativeCount;
+    int nativeCapacity;
+    Globals globals; // persist across evaluations
+    Output out;
+    Tracer tracer;
+    ProfileSite site; // the instruction running, for the sampling profiler
+    PerfCounters* perf; // hardware counters per phase, or NULL
+    LatencyStats latency; // wall time per phase and result counts
+    bool useRegisters; // run chunks on the register engine, except with fuel or tracing
+    Value* result; // where runChunk() wants the result, or NULL to print it
+    long fuel; // instructions left in this slice, or FUEL_UNLIMITED
+    int cancelled; // written by cancelInterpret() from any thread
 } VM;
 
 typedef enum {
     INTERPRET_OK,
     INTERPRET_COMPILE_ERROR,
-    INTERPRET_RUNTIME_ERROR
+    INTERPRET_RUNTIME_ERROR,
+    INTERPRET_YIELD // out of fuel; call resumeInterpret() to continue
 } InterpretResult;
 
 void initVM(VM* vm);
+// Like initVM(), but every allocation the VM makes goes through `allocator`.
+void initVMWithAllocator(VM* vm, const Allocator* allocator);
 void freeVM(VM* vm);
+// Caps the bytes the VM may hold at once; 0 removes the cap. An evaluation
+// that needs more fails with a runtime error, after which the VM drops its
+// chunk cache and remains usable.
+void setMemoryLimit(VM* vm, size_t limit);
+// Sizes the scratch region, where intermediate strings live until their
+// evaluation ends, to hold at least `bytes` at once.
+void reserveScratch(VM* vm, size_t bytes);
+// While frozen, evaluations fail the way they do at the memory limit rather
+// than allocate. Evaluating a cached source whose temporaries fit in the
+// scratch region allocates nothing, so a host can warm the VM up with its
+// sources, freeze it and be sure the allocator is never called again from
+// interpret().
+void freezeMemory(VM* vm, bool frozen);
 InterpretResult interpret(VM* vm, const char* source);
+// Runs at most `fuel` instructions before returning INTERPRET_YIELD with the
+// evaluation suspended. Starting another evaluation discards a suspended one.
+InterpretResult interpretWithFuel(VM* vm, const char* source, long fuel);
+// Runs a chunk built elsewhere (see serialize.h) after verifying it. Takes
+// ownership of the chunk's arrays and leaves `chunk` empty.
+InterpretResult interpretChunk(VM* vm, Chunk* chunk);
+// Loads a chunk image (see serialize.h) and runs it with fuel, as
+// interpretWithFuel(). Loading counts against the memory limit like the rest
+// of the evaluation; a malformed image is a compile error.
+InterpretResult interpretImage(VM* vm, const uint8_t* bytes, size_t length, long fuel);
+// Runs a chunk the caller keeps and has verified against this VM's globals
+// (see verifier.h), storing its result in *result instead of printing it.
+// The chunk can be run again; it is quickened and translated for the
+// register engine only once.
+InterpretResult runChunk(VM* vm, Chunk* chunk, Value* result);
+// Continues a suspended evaluation; returns INTERPRET_OK if there is none.
+InterpretResult resumeInterpret(VM* vm, long fuel);
+// Safe to call from any thread. The running evaluation stops with a runtime
+// error within FUEL_CHECK_INTERVAL instructions.
+void cancelInterpret(VM* vm);
+// Registers a builtin. `name` must outlive the VM. The numeric variants
+// take and return plain doubles and are called without boxing.
+ObjNative* defineNative(VM* vm, const char* name, int arity, Value (*function)(int argCount, Value* args));
+void defineNumberNative1(VM* vm, const char* name, double (*function)(double));
+void defineNumberNative2(VM* vm, const char* name, double (*function)(double, double));
+ObjNative* findNative(VM* vm, const char* name, int length);
 void push(VM* vm, Value value);
 Value pop(VM* vm);
\ No newline at end of file